@@ -0,0 +1,338 @@
+// aggregate.c ... aggregate projections
+// part of Multi-attribute Linear-hashed Files
+// Computes count/min/max, optionally grouped, as tuples are selected
+
+#include <ctype.h>
+#include "defs.h"
+#include "aggregate.h"
+#include "hash.h"
+
+// An aggregate projection is a comma-separated list of items:
+//   n          group by attribute n
+//   count(*)   number of tuples in the group (count(n) is the same,
+//              as attributes are never missing)
+//   min(n)     smallest value of attribute n in the group
+//   max(n)     largest value of attribute n in the group
+// e.g.  '2,count(*)'  gives the number of tuples for each value of
+// attribute 2. Without group-by items there is a single group (and a
+// result row even if no tuples match, with a count of 0).
+// Values are compared as integers if both look like integers, and
+// as strings otherwise.
+// Groups are held in a hash table keyed on the group-by values, and
+// rows come out in the order groups were first seen.
+
+#define AGGHASH 1024  // initial hash table size
+
+typedef enum { AGG_GROUP, AGG_COUNT, AGG_MIN, AGG_MAX } AggKind;
+
+typedef struct {
+	AggKind kind;
+	int     attr;      // attribute (0-based); unused for AGG_COUNT
+	Bool    real;      // attribute holds floats (see tuple.c)
+} AggItem;
+
+typedef struct Group {
+	char  *key;        // group-by values, ',' separated
+	Count  count;      // tuples in group
+	char **vals;       // per item: min/max so far (NULL for others)
+	struct Group *next;   // next in hash chain
+	struct Group *link;   // next in order of creation
+} Group;
+
+struct AggregateRep {
+	Count   nattrs;    // attributes in relation
+	Count   nitems;    // items in projection
+	AggItem *items;
+	int     maxAttr;   // highest attribute used by an item
+	Count   nbuckets;  // hash table size
+	Count   ngroups;   // groups in table
+	Group **table;     // groups by key
+	Group  *first, *last; // groups in order of creation
+};
+
+// is attrstr an aggregate projection (rather than a plain one)?
+
+Bool isAggregate(char *attrstr)
+{
+	return strchr(attrstr, '(') != NULL;
+}
+
+// attribute number (1..nattrs) in s, as 0-based index; -1 if invalid
+
+static int attrNum(char *s, Count len, Count nattrs)
+{
+	if (len == 0 || len > 3) return -1;
+	int n = 0;
+	for (Count i = 0; i < len; i++) {
+		if (!isdigit((unsigned char)s[i])) return -1;
+		n = 10*n + (s[i]-'0');
+	}
+	return (n >= 1 && n <= nattrs) ? n-1 : -1;
+}
+
+// parse one item (len chars at s); FALSE if it isn't valid
+
+static Bool parseItem(char *s, Count len, Count nattrs, AggItem *it)
+{
+	static struct { char *name; AggKind kind; } fns[] = {
+		{ "count(", AGG_COUNT }, { "min(", AGG_MIN }, { "max(", AGG_MAX }
+	};
+	for (int f = 0; f < 3; f++) {
+		Count n = strlen(fns[f].name);
+		if (len <= n || strncmp(s, fns[f].name, n) != 0 || s[len-1] != ')')
+			continue;
+		char *arg = s+n;
+		Count alen = len-n-1;
+		it->kind = fns[f].kind;
+		if (it->kind == AGG_COUNT && alen == 1 && *arg == '*') {
+			it->attr = -1;
+			return TRUE;
+		}
+		it->attr = attrNum(arg, alen, nattrs);
+		return it->attr >= 0;
+	}
+	it->kind = AGG_GROUP;
+	it->attr = attrNum(s, len, nattrs);
+	return it->attr >= 0;
+}
+
+// set up an aggregate projection on r; NULL if attrstr is invalid
+
+Aggregate startAggregate(Reln r, char *attrstr)
+{
+	Aggregate new = malloc(sizeof(struct AggregateRep));
+	assert(new != NULL);
+	new->nattrs = nattrs(r);
+	Count n = 1;
+	for (char *c = attrstr; *c != '\0'; c++) {
+		if (*c == ',') n++;
+	}
+	new->items = malloc(n * sizeof(AggItem));
+	assert(new->items != NULL);
+	new->nitems = n;
+	new->maxAttr = -1;
+	new->nbuckets = AGGHASH;
+	new->ngroups = 0;
+	new->table = calloc(new->nbuckets, sizeof(Group *));
+	assert(new->table != NULL);
+	new->first = new->last = NULL;
+
+	char *c = attrstr;
+	for (Count i = 0; i < n; i++) {
+		char *end = strchr(c, ',');
+		Count len = (end == NULL) ? strlen(c) : end - c;
+		if (!parseItem(c, len, new->nattrs, &new->items[i])) {
+			closeAggregate(new);
+			return NULL;
+		}
+		if (new->items[i].attr > new->maxAttr) new->maxAttr = new->items[i].attr;
+		new->items[i].real = new->items[i].attr >= 0
+		                  && attrType(r, new->items[i].attr) == TYPE_FLOAT;
+		c = end + 1;
+	}
+	return new;
+}
+
+// compare two values, as integers if both look like integers,
+//   or as doubles if they come from a float attribute
+
+static Bool isInteger(char *v, Count len)
+{
+	Count i = (len > 0 && v[0] == '-') ? 1 : 0;
+	if (i == len || len - i > 18) return FALSE;
+	for (; i < len; i++) {
+		if (!isdigit((unsigned char)v[i])) return FALSE;
+	}
+	return TRUE;
+}
+
+static int compareValues(char *a, char *b, Count blen, Bool real)
+{
+	Count alen = strlen(a);
+	if (real) {
+		double x = strtod(a, NULL), y = strtod(b, NULL);
+		return (x < y) ? -1 : (x > y);
+	}
+	if (isInteger(a, alen) && isInteger(b, blen)) {
+		long long x = strtoll(a, NULL, 10), y = strtoll(b, NULL, 10);
+		return (x < y) ? -1 : (x > y);
+	}
+	Count n = (alen < blen) ? alen : blen;
+	int cmp = memcmp(a, b, n);
+	if (cmp != 0) return cmp;
+	return (alen < blen) ? -1 : (alen > blen);
+}
+
+static char *copySpan(char *s, Count len)
+{
+	char *c = malloc(len + 1);
+	assert(c != NULL);
+	memcpy(c, s, len);
+	c[len] = '\0';
+	return c;
+}
+
+// double the hash table once groups outnumber buckets
+
+static void growTable(Aggregate a)
+{
+	Count n = 2*a->nbuckets;
+	Group **table = calloc(n, sizeof(Group *));
+	assert(table != NULL);
+	for (Group *g = a->first; g != NULL; g = g->link) {
+		Bits h = hash_any((unsigned char *)g->key, strlen(g->key)) % n;
+		g->next = table[h];
+		table[h] = g;
+	}
+	free(a->table);
+	a->table = table;
+	a->nbuckets = n;
+}
+
+// find the group with key (len bytes), creating it if needed
+
+static Group *findGroup(Aggregate a, char *key, Count len)
+{
+	Bits h = hash_any((unsigned char *)key, len);
+	Group *g;
+	for (g = a->table[h % a->nbuckets]; g != NULL; g = g->next) {
+		if (strncmp(g->key, key, len) == 0 && g->key[len] == '\0') return g;
+	}
+	g = malloc(sizeof(Group));
+	assert(g != NULL);
+	g->key = copySpan(key, len);
+	g->count = 0;
+	g->vals = calloc(a->nitems, sizeof(char *));
+	assert(g->vals != NULL);
+	g->next = a->table[h % a->nbuckets];
+	a->table[h % a->nbuckets] = g;
+	g->link = NULL;
+	if (a->last != NULL) a->last->link = g; else a->first = g;
+	a->last = g;
+	if (++a->ngroups > a->nbuckets) growTable(a);
+	return g;
+}
+
+// add tuple t (len bytes) to its group
+
+void aggregateTuple(Aggregate a, char *t, Count len)
+{
+	// locate the fields that the items use
+	char *start[a->maxAttr+2];
+	Count flen[a->maxAttr+2];
+	char *c = t, *end = t + len;
+	int nf = 0;
+	while (nf <= a->maxAttr) {
+		char *comma = memchr(c, ',', end - c);
+		start[nf] = c;
+		flen[nf] = ((comma == NULL) ? end : comma) - c;
+		nf++;
+		if (comma == NULL) break;
+		c = comma + 1;
+	}
+	for (; nf <= a->maxAttr; nf++) { start[nf] = end; flen[nf] = 0; }
+
+	// group key: the group-by values in item order
+	char key[len + a->nitems + 1];
+	Count klen = 0;
+	for (Count i = 0; i < a->nitems; i++) {
+		AggItem *it = &a->items[i];
+		if (it->kind != AGG_GROUP) continue;
+		if (klen > 0) key[klen++] = ',';
+		memcpy(key+klen, start[it->attr], flen[it->attr]);
+		klen += flen[it->attr];
+	}
+	Group *g = findGroup(a, key, klen);
+
+	g->count++;
+	for (Count i = 0; i < a->nitems; i++) {
+		AggItem *it = &a->items[i];
+		if (it->kind != AGG_MIN && it->kind != AGG_MAX) continue;
+		char *v = start[it->attr];
+		Count vlen = flen[it->attr];
+		int cmp = (g->vals[i] == NULL) ? 0 : compareValues(g->vals[i], v, vlen, it->real);
+		if (g->vals[i] == NULL || (it->kind == AGG_MIN ? cmp > 0 : cmp < 0)) {
+			free(g->vals[i]);
+			g->vals[i] = copySpan(v, vlen);
+		}
+	}
+}
+
+// is every item a count, with no grouping? (then only the number
+//   of tuples matters, not what they hold)
+
+Bool countsOnly(Aggregate a)
+{
+	for (Count i = 0; i < a->nitems; i++) {
+		if (a->items[i].kind != AGG_COUNT) return FALSE;
+	}
+	return TRUE;
+}
+
+// add n tuples, unseen, to a counts-only aggregate
+
+void aggregateCount(Aggregate a, Count n)
+{
+	assert(countsOnly(a));
+	findGroup(a, "", 0)->count += n;
+}
+
+// write one row per group: the items, in order, ',' separated
+
+void putAggregates(Aggregate a, Output out)
+{
+	// a query with no group-by items has one row, even with no tuples
+	if (a->first == NULL) {
+		for (Count i = 0; i < a->nitems; i++) {
+			if (a->items[i].kind == AGG_GROUP) return;
+		}
+		findGroup(a, "", 0);
+	}
+	for (Group *g = a->first; g != NULL; g = g->link) {
+		Count size = strlen(g->key) + 16*a->nitems + 1;
+		for (Count i = 0; i < a->nitems; i++) {
+			if (g->vals[i] != NULL) size += strlen(g->vals[i]);
+		}
+		char *row = malloc(size);
+		assert(row != NULL);
+		char *r = row;
+		char *k = g->key;  // group-by values are taken from the key in turn
+		for (Count i = 0; i < a->nitems; i++) {
+			AggItem *it = &a->items[i];
+			if (i > 0) *r++ = ',';
+			switch (it->kind) {
+			case AGG_GROUP: {
+				char *end = strchr(k, ',');
+				Count n = (end == NULL) ? strlen(k) : end - k;
+				memcpy(r, k, n); r += n;
+				k += (end == NULL) ? n : n+1;
+				break;
+			}
+			case AGG_COUNT:
+				r += sprintf(r, "%u", g->count);
+				break;
+			default:
+				if (g->vals[i] != NULL) r += sprintf(r, "%s", g->vals[i]);
+				break;
+			}
+		}
+		putTuple(out, row, r - row);
+		free(row);
+	}
+}
+
+void closeAggregate(Aggregate a)
+{
+	Group *g = a->first;
+	while (g != NULL) {
+		Group *next = g->link;
+		for (Count i = 0; i < a->nitems; i++) free(g->vals[i]);
+		free(g->vals);
+		free(g->key);
+		free(g);
+		g = next;
+	}
+	free(a->table);
+	free(a->items);
+	free(a);
+}
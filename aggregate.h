@@ -0,0 +1,22 @@
+// aggregate.h ... interface to aggregate projections
+// part of Multi-attribute Linear-hashed Files
+// See aggregate.c for details of Aggregate type and functions
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H 1
+
+typedef struct AggregateRep *Aggregate;
+
+#include "defs.h"
+#include "reln.h"
+#include "output.h"
+
+Bool isAggregate(char *attrstr);
+Aggregate startAggregate(Reln r, char *attrstr);
+void aggregateTuple(Aggregate a, char *t, Count len);
+Bool countsOnly(Aggregate a);
+void aggregateCount(Aggregate a, Count n);
+void putAggregates(Aggregate a, Output out);
+void closeAggregate(Aggregate a);
+
+#endif
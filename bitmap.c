@@ -0,0 +1,790 @@
+// bitmap.c ... bitmap indexes on low-cardinality attributes
+// part of Multi-attribute Linear-hashed Files
+// Map each value of an attribute to the set of positions holding it
+
+#include <pthread.h>
+#include <unistd.h>
+#include "defs.h"
+#include "bitmap.h"
+#include "hash.h"
+
+// A bitmap index on attribute a keeps, for every value of a, the set
+// of positions of the tuples with that value. A tuple's position is
+// made from its bucket and its place in the bucket's chain:
+//   bucket << BMLOCAL | (page# * BMSLOTS + slot)
+// so positions run bucket by bucket, in the order a scan meets the
+// tuples. Each bucket has a small table of the overflow pages in its
+// chain that hold indexed tuples, which gives their page# (the data
+// page is page# 0).
+// The sets are compressed as Roaring bitmaps are: positions are split
+// on their top 16 bits into containers, each holding the low 16 bits
+// of its positions as a sorted array (up to BMARRAYMAX of them) or,
+// when fuller, as a bitmap of 2^16 bits. Exact values on several
+// indexed attributes are combined by intersecting their sets container
+// by container, before any page is read; the size of the intersection
+// is the number of tuples with all of those values.
+// Only the first 2^BMLOCAL slots of a chain have positions. While any
+// bucket has tuples beyond them (a chain of over BMLOCAL/BMSLOTS
+// pages), the index can't be used; splits shorten chains again.
+// Like the Bloom filters and hash indexes, a writer keeps the index in
+// memory while the relation is open, and saves it in RelName.bmap when
+// it closes:
+// - header: magic, clean flag, #attrs, indexed attributes, #buckets,
+//   #values
+// - per bucket: spilled flag, #pages, the overflow pages
+// - per value: attribute, value length, #containers, offset and size
+//   of its set, and the value
+// - the sets: per container, its key and #positions, then the array
+//   or bitmap
+// Readers load only the values and page tables, and read a value's
+// set when it is looked up. The clean flag is handled as in bloom.c:
+// an index that a writer may have left half-changed is never used.
+
+#define BMAPMAGIC  0x626d6170  // "bmap"
+#define BMAPSIZE   256         // initial hash table size
+#define BMLOCAL    13          // position bits within a bucket
+#define BMSLOTS    256         // most tuples in a page (4-byte tuples)
+#define BMARRAYMAX 4096        // most positions in an array container
+#define BMWORDS    (0x10000/64) // words in a bitmap container
+
+typedef unsigned short Low;      // low 16 bits of a position
+typedef unsigned long long Word; // 64 bits of a bitmap container
+
+typedef struct {
+	Count magic;    // BMAPMAGIC
+	Count clean;    // index matches the relation
+	Count nattrs;   // attributes in relation
+	Count attrs;    // bit a set if attribute a is indexed
+	Count nbuckets; // buckets with page tables
+	Count nvalues;  // (attribute, value) sets
+} BitmapHeader;
+
+typedef struct {
+	Count key;     // top 16 bits of its positions
+	Count card;    // positions held
+	Count size;    // array slots allocated
+	Low  *array;   // sorted low bits (if card <= BMARRAYMAX)
+	Word *bits;    // bitmap of low bits (otherwise; array is NULL)
+} Container;
+
+struct BitmapRep {
+	Count n;         // containers in use
+	Count size;      // containers allocated
+	Container *cs;   // ordered on key
+};
+
+typedef struct Value {
+	Count  attr;     // attribute
+	Count  len;      // value length
+	char  *val;      // value (not '\0'-terminated)
+	Bits   hash;     // hash of value
+	Count  off;      // readers: offset of saved set in file
+	Count  bytes;    // readers: size of saved set
+	Count  ncs;      // readers: containers in saved set
+	struct BitmapRep set;  // writers: positions with this value
+	struct Value *next;    // next in hash chain
+} Value;
+
+// overflow pages of a bucket's chain that hold indexed tuples
+typedef struct {
+	Count   spilled; // bucket has tuples without a position
+	Count   npages;  // pages in table
+	PageID *pages;   // page# i+1 is pages[i]
+} Chain;
+
+struct BitmapIndexRep {
+	FILE   *file;     // RelName.bmap
+	Bool    writer;   // write index back on close
+	Count   nattrs;   // attributes in relation
+	Count   attrs;    // bit a set if attribute a is indexed
+	Count   nslots;   // hash table size
+	Count   nvalues;  // values in table
+	Value **table;    // values by hash
+	Count   nbuckets; // buckets with chains
+	Count   size;     // chains allocated
+	Chain  *chains;   // per bucket
+	Count   spilled;  // buckets with tuples beyond BMLOCAL
+	pthread_mutex_t lock;  // inserters in different buckets share the sets
+};
+
+// --------------------------------------------------------------------------
+// Compressed sets
+
+static Bitmap newBitmap(void)
+{
+	Bitmap b = malloc(sizeof(struct BitmapRep));
+	assert(b != NULL);
+	b->n = b->size = 0;
+	b->cs = NULL;
+	return b;
+}
+
+static void clearSet(Bitmap b)
+{
+	for (Count i = 0; i < b->n; i++) {
+		free(b->cs[i].array);
+		free(b->cs[i].bits);
+	}
+	free(b->cs);
+	b->n = b->size = 0;
+	b->cs = NULL;
+}
+
+void bmapFree(Bitmap b)
+{
+	if (b == NULL) return;
+	clearSet(b);
+	free(b);
+}
+
+// index of the container for key in b, or of where it would go
+
+static Count findKey(Bitmap b, Count key)
+{
+	Count lo = 0, hi = b->n;
+	while (lo < hi) {
+		Count mid = (lo + hi) / 2;
+		if (b->cs[mid].key < key) lo = mid+1; else hi = mid;
+	}
+	return lo;
+}
+
+// add an empty container for key at index i
+
+static Container *insertContainer(Bitmap b, Count i, Count key)
+{
+	if (b->n == b->size) {
+		b->size = (b->size == 0) ? 4 : 2*b->size;
+		b->cs = realloc(b->cs, b->size * sizeof(Container));
+		assert(b->cs != NULL);
+	}
+	memmove(&b->cs[i+1], &b->cs[i], (b->n - i) * sizeof(Container));
+	b->n++;
+	Container *c = &b->cs[i];
+	c->key = key;
+	c->card = c->size = 0;
+	c->array = NULL;
+	c->bits = NULL;
+	return c;
+}
+
+static void removeContainer(Bitmap b, Count i)
+{
+	free(b->cs[i].array);
+	free(b->cs[i].bits);
+	memmove(&b->cs[i], &b->cs[i+1], (b->n - i - 1) * sizeof(Container));
+	b->n--;
+}
+
+static Bool hasBit(Word *bits, Count low)
+{
+	return (bits[low/64] >> (low%64)) & 1;
+}
+
+// switch container c from an array to a bitmap
+
+static void toBits(Container *c)
+{
+	c->bits = calloc(BMWORDS, sizeof(Word));
+	assert(c->bits != NULL);
+	for (Count i = 0; i < c->card; i++)
+		c->bits[c->array[i]/64] |= (Word)1 << (c->array[i]%64);
+	free(c->array);
+	c->array = NULL;
+	c->size = 0;
+}
+
+// switch container c from a bitmap to an array (c->card is right)
+
+static void toArray(Container *c)
+{
+	c->size = (c->card == 0) ? 1 : c->card;
+	c->array = malloc(c->size * sizeof(Low));
+	assert(c->array != NULL);
+	Count n = 0;
+	for (Count w = 0; w < BMWORDS; w++) {
+		for (Word bits = c->bits[w]; bits != 0; bits &= bits-1)
+			c->array[n++] = w*64 + __builtin_ctzll(bits);
+	}
+	free(c->bits);
+	c->bits = NULL;
+}
+
+static void addPosition(Bitmap b, Count pos)
+{
+	Count key = pos >> 16, low = pos & 0xffff;
+	Count i = findKey(b, key);
+	Container *c = (i < b->n && b->cs[i].key == key) ? &b->cs[i] : insertContainer(b, i, key);
+	if (c->bits != NULL) {
+		if (!hasBit(c->bits, low)) {
+			c->bits[low/64] |= (Word)1 << (low%64);
+			c->card++;
+		}
+		return;
+	}
+	// positions mostly arrive in order, so look from the end
+	Count j = c->card;
+	while (j > 0 && c->array[j-1] > low) j--;
+	if (j > 0 && c->array[j-1] == low) return;
+	if (c->card == BMARRAYMAX) {
+		toBits(c);
+		c->bits[low/64] |= (Word)1 << (low%64);
+		c->card++;
+		return;
+	}
+	if (c->card == c->size) {
+		c->size = (c->size == 0) ? 4 : 2*c->size;
+		c->array = realloc(c->array, c->size * sizeof(Low));
+		assert(c->array != NULL);
+	}
+	memmove(&c->array[j+1], &c->array[j], (c->card - j) * sizeof(Low));
+	c->array[j] = low;
+	c->card++;
+}
+
+// remove the positions from lo to hi-1 (all with the same key) from b
+
+static void removeRange(Bitmap b, Count lo, Count hi)
+{
+	Count key = lo >> 16;
+	Count i = findKey(b, key);
+	if (i == b->n || b->cs[i].key != key) return;
+	Container *c = &b->cs[i];
+	lo &= 0xffff; hi = ((hi-1) & 0xffff) + 1;
+	if (c->bits != NULL) {
+		for (Count low = lo; low < hi; low++) {
+			if (hasBit(c->bits, low)) {
+				c->bits[low/64] &= ~((Word)1 << (low%64));
+				c->card--;
+			}
+		}
+		if (c->card <= BMARRAYMAX) toArray(c);
+	}
+	else {
+		Count from = 0, to;
+		while (from < c->card && c->array[from] < lo) from++;
+		for (to = from; to < c->card && c->array[to] < hi; to++) ;
+		memmove(&c->array[from], &c->array[to], (c->card - to) * sizeof(Low));
+		c->card -= to - from;
+	}
+	if (c->card == 0) removeContainer(b, i);
+}
+
+static void copySet(Bitmap to, Bitmap from)
+{
+	to->n = to->size = from->n;
+	to->cs = malloc((from->n+1) * sizeof(Container));
+	assert(to->cs != NULL);
+	for (Count i = 0; i < from->n; i++) {
+		Container *c = &to->cs[i], *f = &from->cs[i];
+		*c = *f;
+		if (f->bits != NULL) {
+			c->bits = malloc(BMWORDS * sizeof(Word));
+			assert(c->bits != NULL);
+			memcpy(c->bits, f->bits, BMWORDS * sizeof(Word));
+		}
+		else {
+			c->size = (f->card == 0) ? 1 : f->card;
+			c->array = malloc(c->size * sizeof(Low));
+			assert(c->array != NULL);
+			memcpy(c->array, f->array, f->card * sizeof(Low));
+		}
+	}
+}
+
+// intersect containers x and y into out (which has x's key)
+// out->card is 0 if they have nothing in common
+
+static void andContainers(Container *x, Container *y, Container *out)
+{
+	if (x->bits != NULL && y->bits != NULL) {
+		out->bits = malloc(BMWORDS * sizeof(Word));
+		assert(out->bits != NULL);
+		out->card = 0;
+		for (Count w = 0; w < BMWORDS; w++) {
+			out->bits[w] = x->bits[w] & y->bits[w];
+			out->card += __builtin_popcountll(out->bits[w]);
+		}
+		if (out->card <= BMARRAYMAX) toArray(out);
+		return;
+	}
+	// at least one array, so the result fits in an array
+	if (x->array == NULL) { Container *t = x; x = y; y = t; }
+	out->size = (x->card == 0) ? 1 : x->card;
+	out->array = malloc(out->size * sizeof(Low));
+	assert(out->array != NULL);
+	out->card = 0;
+	if (y->bits != NULL) {
+		for (Count i = 0; i < x->card; i++) {
+			if (hasBit(y->bits, x->array[i])) out->array[out->card++] = x->array[i];
+		}
+		return;
+	}
+	Count i = 0, j = 0;
+	while (i < x->card && j < y->card) {
+		if (x->array[i] < y->array[j]) i++;
+		else if (x->array[i] > y->array[j]) j++;
+		else { out->array[out->card++] = x->array[i]; i++; j++; }
+	}
+}
+
+// intersection of a and b, as a new set
+
+Bitmap bmapAnd(Bitmap a, Bitmap b)
+{
+	Bitmap r = newBitmap();
+	Count i = 0, j = 0;
+	while (i < a->n && j < b->n) {
+		if (a->cs[i].key < b->cs[j].key) { i++; continue; }
+		if (a->cs[i].key > b->cs[j].key) { j++; continue; }
+		Container *c = insertContainer(r, r->n, a->cs[i].key);
+		andContainers(&a->cs[i], &b->cs[j], c);
+		if (c->card == 0) removeContainer(r, r->n-1);
+		i++; j++;
+	}
+	return r;
+}
+
+// number of positions in b
+
+Count bmapCount(Bitmap b)
+{
+	Count n = 0;
+	for (Count i = 0; i < b->n; i++) n += b->cs[i].card;
+	return n;
+}
+
+// --------------------------------------------------------------------------
+// Saved sets
+
+static Count setBytes(Bitmap b)
+{
+	Count n = 0;
+	for (Count i = 0; i < b->n; i++) {
+		Container *c = &b->cs[i];
+		n += 2*sizeof(Count) + ((c->bits != NULL) ? BMWORDS*sizeof(Word) : c->card*sizeof(Low));
+	}
+	return n;
+}
+
+// write the set b to f; FALSE if a write came up short
+
+static Bool writeSet(Bitmap b, FILE *f)
+{
+	for (Count i = 0; i < b->n; i++) {
+		Container *c = &b->cs[i];
+		Count hdr[2] = { c->key, c->card };
+		if (fwrite(hdr, sizeof(Count), 2, f) != 2) return FALSE;
+		if (c->bits != NULL) {
+			if (fwrite(c->bits, sizeof(Word), BMWORDS, f) != BMWORDS)
+				return FALSE;
+		}
+		else if (c->card > 0) {
+			if (fwrite(c->array, sizeof(Low), c->card, f) != c->card)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// read the saved set of v into b; FALSE if it's incomplete
+
+static Bool readSet(BitmapIndex x, Value *v, Bitmap b)
+{
+	Byte *buf = malloc(v->bytes + 1);
+	assert(buf != NULL);
+	Bool ok = pread(fileno(x->file), buf, v->bytes, v->off) == v->bytes;
+	Byte *p = buf, *end = buf + v->bytes;
+	for (Count i = 0; ok && i < v->ncs; i++) {
+		Count hdr[2];  // key, #positions
+		if (end - p < sizeof(hdr)) { ok = FALSE; break; }
+		memcpy(hdr, p, sizeof(hdr));
+		p += sizeof(hdr);
+		Container *c = insertContainer(b, b->n, hdr[0]);
+		c->card = hdr[1];
+		if (c->card > BMARRAYMAX) {
+			c->bits = malloc(BMWORDS * sizeof(Word));
+			assert(c->bits != NULL);
+			ok = (end - p >= BMWORDS*sizeof(Word));
+			if (ok) memcpy(c->bits, p, BMWORDS*sizeof(Word));
+			p += BMWORDS*sizeof(Word);
+		}
+		else {
+			c->size = (c->card == 0) ? 1 : c->card;
+			c->array = malloc(c->size * sizeof(Low));
+			assert(c->array != NULL);
+			ok = (end - p >= c->card*sizeof(Low));
+			if (ok) memcpy(c->array, p, c->card*sizeof(Low));
+			p += c->card*sizeof(Low);
+		}
+	}
+	free(buf);
+	return ok;
+}
+
+// --------------------------------------------------------------------------
+// Indexes
+
+static void writeHeader(BitmapIndex x, Bool clean)
+{
+	BitmapHeader h = { BMAPMAGIC, clean, x->nattrs, x->attrs, x->nbuckets, x->nvalues };
+	ssize_t n = pwrite(fileno(x->file), &h, sizeof(h), 0);
+	assert(n == sizeof(h));
+}
+
+// value attr = val (len bytes); created if create is set
+
+static Value *findValue(BitmapIndex x, Count attr, char *val, Count len, Bool create)
+{
+	Bits h = hash_any((unsigned char *)val, len) ^ attr;
+	Value *v;
+	for (v = x->table[h % x->nslots]; v != NULL; v = v->next) {
+		if (v->hash == h && v->attr == attr && v->len == len
+		    && memcmp(v->val, val, len) == 0)
+			return v;
+	}
+	if (!create) return NULL;
+	v = malloc(sizeof(Value));
+	assert(v != NULL);
+	v->attr = attr;
+	v->len = len;
+	v->val = malloc(len + 1);
+	assert(v->val != NULL);
+	memcpy(v->val, val, len);
+	v->hash = h;
+	v->off = v->bytes = v->ncs = 0;
+	v->set.n = v->set.size = 0;
+	v->set.cs = NULL;
+	v->next = x->table[h % x->nslots];
+	x->table[h % x->nslots] = v;
+	if (++x->nvalues > x->nslots) {
+		// double the table once values outnumber its slots
+		Count n = 2*x->nslots;
+		Value **table = calloc(n, sizeof(Value *));
+		assert(table != NULL);
+		for (Count i = 0; i < x->nslots; i++) {
+			Value *next;
+			for (Value *w = x->table[i]; w != NULL; w = next) {
+				next = w->next;
+				w->next = table[w->hash % n];
+				table[w->hash % n] = w;
+			}
+		}
+		free(x->table);
+		x->table = table;
+		x->nslots = n;
+	}
+	return v;
+}
+
+// make sure there are chains for buckets up to nbuckets
+
+static void growChains(BitmapIndex x, Count nbuckets)
+{
+	if (nbuckets > x->size) {
+		Count size = 2*x->size;
+		if (size < nbuckets) size = nbuckets;
+		x->chains = realloc(x->chains, size * sizeof(Chain));
+		assert(x->chains != NULL);
+		x->size = size;
+	}
+	for (; x->nbuckets < nbuckets; x->nbuckets++) {
+		Chain *ch = &x->chains[x->nbuckets];
+		ch->spilled = ch->npages = 0;
+		ch->pages = NULL;
+	}
+}
+
+// read the page tables and the values (with their sets, for writers)
+// FALSE if they're missing or incomplete
+
+static Bool loadIndex(BitmapIndex x, BitmapHeader *h)
+{
+	growChains(x, h->nbuckets);
+	for (Count b = 0; b < h->nbuckets; b++) {
+		Chain *ch = &x->chains[b];
+		Count hdr[2];  // spilled, #pages
+		if (fread(hdr, sizeof(Count), 2, x->file) != 2) return FALSE;
+		if (hdr[1] > (1 << BMLOCAL) / BMSLOTS) return FALSE;
+		ch->spilled = hdr[0];
+		ch->npages = hdr[1];
+		ch->pages = malloc((ch->npages+1) * sizeof(PageID));
+		assert(ch->pages != NULL);
+		if (fread(ch->pages, sizeof(PageID), ch->npages, x->file) != ch->npages)
+			return FALSE;
+		if (ch->spilled) x->spilled++;
+	}
+	for (Count i = 0; i < h->nvalues; i++) {
+		Count hdr[5];  // attribute, length, #containers, offset, size
+		char val[MAXTUPLEN];
+		if (fread(hdr, sizeof(Count), 5, x->file) != 5) return FALSE;
+		if (hdr[0] >= x->nattrs || hdr[1] > MAXTUPLEN) return FALSE;
+		if (fread(val, 1, hdr[1], x->file) != hdr[1]) return FALSE;
+		Value *v = findValue(x, hdr[0], val, hdr[1], TRUE);
+		v->ncs = hdr[2]; v->off = hdr[3]; v->bytes = hdr[4];
+	}
+	if (!x->writer) return TRUE;
+	for (Count i = 0; i < x->nslots; i++) {
+		for (Value *v = x->table[i]; v != NULL; v = v->next) {
+			if (!readSet(x, v, &v->set)) return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// open the bitmap indexes on attributes attrs (bit a for attribute a)
+//   of relation name
+// writers get an index even if none could be loaded (*stale is then
+//   set, and the caller must re-add every tuple); readers get NULL
+//   if there is no trustworthy index
+
+BitmapIndex bmapOpen(char *name, Count nattrs, Count attrs, Bool writer, Bool *stale)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname,"%s.bmap",name);
+	FILE *f = fopen(fname, writer ? "r+" : "r");
+	if (f == NULL && writer) f = fopen(fname, "w+");
+	if (f == NULL) return NULL;
+
+	BitmapIndex x = malloc(sizeof(struct BitmapIndexRep));
+	assert(x != NULL);
+	x->file = f;
+	x->writer = writer;
+	x->nattrs = nattrs;
+	x->attrs = attrs;
+	x->nslots = BMAPSIZE;
+	x->nvalues = 0;
+	x->table = calloc(x->nslots, sizeof(Value *));
+	assert(x->table != NULL);
+	x->nbuckets = x->size = x->spilled = 0;
+	x->chains = NULL;
+	pthread_mutex_init(&x->lock, NULL);
+
+	BitmapHeader h;
+	Bool ok = fread(&h, sizeof(h), 1, f) == 1
+	       && h.magic == BMAPMAGIC && h.clean
+	       && h.nattrs == nattrs && h.attrs == attrs;
+	if (ok) ok = loadIndex(x, &h);
+	if (!ok) bmapClear(x);
+	*stale = !ok;
+	if (!writer) {
+		if (!ok) { bmapClose(x); return NULL; }
+		return x;
+	}
+	// on-disk index is out of date until we close
+	writeHeader(x, FALSE);
+	fsync(fileno(f));
+	return x;
+}
+
+// writers: save the page tables, values and sets
+// values whose tuples have all moved away are dropped
+// the clean flag is only set once everything is on disk; after a
+//   short write the index stays stale, and is rebuilt on next open
+
+static void saveIndex(BitmapIndex x)
+{
+	Value **vs = malloc((x->nvalues+1) * sizeof(Value *));
+	assert(vs != NULL);
+	Count n = 0;
+	for (Count i = 0; i < x->nslots; i++) {
+		for (Value *v = x->table[i]; v != NULL; v = v->next) {
+			if (v->set.n > 0) vs[n++] = v;
+		}
+	}
+	// the sets follow the values
+	Count off = sizeof(BitmapHeader);
+	for (Count b = 0; b < x->nbuckets; b++)
+		off += (2 + x->chains[b].npages) * sizeof(Count);
+	for (Count i = 0; i < n; i++)
+		off += 5*sizeof(Count) + vs[i]->len;
+
+	Bool ok = fseek(x->file, sizeof(BitmapHeader), SEEK_SET) == 0;
+	for (Count b = 0; ok && b < x->nbuckets; b++) {
+		Chain *ch = &x->chains[b];
+		Count hdr[2] = { ch->spilled, ch->npages };
+		ok = fwrite(hdr, sizeof(Count), 2, x->file) == 2;
+		if (ok && ch->npages > 0)
+			ok = fwrite(ch->pages, sizeof(PageID), ch->npages, x->file)
+			     == ch->npages;
+	}
+	for (Count i = 0; ok && i < n; i++) {
+		Value *v = vs[i];
+		Count bytes = setBytes(&v->set);
+		Count hdr[5] = { v->attr, v->len, v->set.n, off, bytes };
+		ok = fwrite(hdr, sizeof(Count), 5, x->file) == 5
+		  && fwrite(v->val, 1, v->len, x->file) == v->len;
+		off += bytes;
+	}
+	for (Count i = 0; ok && i < n; i++) ok = writeSet(&vs[i]->set, x->file);
+	ok = fflush(x->file) == 0 && ok;
+	if (ok) ok = ftruncate(fileno(x->file), ftell(x->file)) == 0;
+	if (ok) ok = fsync(fileno(x->file)) == 0;
+	x->nvalues = n;
+	if (ok) {
+		writeHeader(x, TRUE);
+		fsync(fileno(x->file));
+	}
+	free(vs);
+}
+
+// save the index (writers) and release it
+
+void bmapClose(BitmapIndex x)
+{
+	if (x->writer) saveIndex(x);
+	bmapClear(x);
+	fclose(x->file);
+	free(x->table);
+	free(x->chains);
+	pthread_mutex_destroy(&x->lock);
+	free(x);
+}
+
+// remove every value and page table
+
+void bmapClear(BitmapIndex x)
+{
+	for (Count i = 0; i < x->nslots; i++) {
+		Value *next;
+		for (Value *v = x->table[i]; v != NULL; v = next) {
+			next = v->next;
+			clearSet(&v->set);
+			free(v->val);
+			free(v);
+		}
+		x->table[i] = NULL;
+	}
+	x->nvalues = 0;
+	for (Count b = 0; b < x->nbuckets; b++) free(x->chains[b].pages);
+	x->nbuckets = x->spilled = 0;
+}
+
+// can the index on attribute attr be used?
+
+Bool bmapHas(BitmapIndex x, Count attr)
+{
+	return attr < x->nattrs && (x->attrs & (1 << attr)) != 0 && x->spilled == 0;
+}
+
+// position of the tuple at loc, which is added to bucket's page
+//   table if need be; NO_PAGE if it can't have one
+
+static Count position(BitmapIndex x, IndexLoc loc)
+{
+	growChains(x, loc.bucket+1);
+	Chain *ch = &x->chains[loc.bucket];
+	Count k = 0;
+	if (loc.page != NO_PAGE) {
+		while (k < ch->npages && ch->pages[k] != loc.page) k++;
+		if (k == ch->npages) {
+			if (k+1 >= (1 << BMLOCAL) / BMSLOTS) return NO_PAGE;
+			ch->pages = realloc(ch->pages, (ch->npages+1) * sizeof(PageID));
+			assert(ch->pages != NULL);
+			ch->pages[ch->npages++] = loc.page;
+		}
+		k++;
+	}
+	if (loc.slot >= BMSLOTS || loc.bucket >= (1u << (32 - BMLOCAL)) - 1) return NO_PAGE;
+	return (loc.bucket << BMLOCAL) | (k*BMSLOTS + loc.slot);
+}
+
+// record that the tuple at loc holds t's values of indexed attributes
+
+void bmapAddTuple(BitmapIndex x, IndexLoc loc, Tuple t)
+{
+	pthread_mutex_lock(&x->lock);
+	Count pos = position(x, loc);
+	if (pos == NO_PAGE) {
+		Chain *ch = &x->chains[loc.bucket];
+		if (!ch->spilled) x->spilled++;
+		ch->spilled = TRUE;
+		pthread_mutex_unlock(&x->lock);
+		return;
+	}
+	char *c = t;
+	for (Count a = 0; a < x->nattrs; a++) {
+		char *end = strchr(c, ',');
+		Count len = (end == NULL) ? strlen(c) : end - c;
+		if (x->attrs & (1 << a)) addPosition(&findValue(x, a, c, len, TRUE)->set, pos);
+		if (end == NULL) break;
+		c = end + 1;
+	}
+	pthread_mutex_unlock(&x->lock);
+}
+
+// forget all the tuples in bucket
+// used when a bucket's tuples are taken out to be redistributed
+
+void bmapRemoveBucket(BitmapIndex x, PageID bucket)
+{
+	pthread_mutex_lock(&x->lock);
+	if (bucket < x->nbuckets) {
+		Count lo = bucket << BMLOCAL, hi = lo + (1 << BMLOCAL);
+		for (Count i = 0; i < x->nslots; i++) {
+			for (Value *v = x->table[i]; v != NULL; v = v->next)
+				removeRange(&v->set, lo, hi);
+		}
+		Chain *ch = &x->chains[bucket];
+		if (ch->spilled) x->spilled--;
+		ch->spilled = ch->npages = 0;
+	}
+	pthread_mutex_unlock(&x->lock);
+}
+
+// positions of the tuples whose attribute attr is val (len bytes), as
+//   a new set (empty if there are none)
+
+Bitmap bmapLookup(BitmapIndex x, Count attr, char *val, Count len)
+{
+	pthread_mutex_lock(&x->lock);
+	Bitmap b = newBitmap();
+	Value *v = findValue(x, attr, val, len, FALSE);
+	if (v != NULL) {
+		if (x->writer)
+			copySet(b, &v->set);
+		else if (!readSet(x, v, b))
+			clearSet(b);
+	}
+	pthread_mutex_unlock(&x->lock);
+	return b;
+}
+
+// location of the tuple at pos, added at *l; FALSE if there isn't one
+
+static Bool location(BitmapIndex x, Count pos, IndexLoc *l)
+{
+	Count local = pos & ((1 << BMLOCAL) - 1);
+	Count k = local / BMSLOTS;
+	l->bucket = pos >> BMLOCAL;
+	l->slot = local % BMSLOTS;
+	if (l->bucket >= x->nbuckets || k > x->chains[l->bucket].npages) return FALSE;
+	l->page = (k == 0) ? NO_PAGE : x->chains[l->bucket].pages[k-1];
+	return TRUE;
+}
+
+// the locations of the positions in b, in scan order
+// *locs is set to a malloc'd array; returns the number of locations
+
+Count bmapLocations(BitmapIndex x, Bitmap b, IndexLoc **locs)
+{
+	pthread_mutex_lock(&x->lock);
+	Count n = 0;
+	*locs = malloc((bmapCount(b)+1) * sizeof(IndexLoc));
+	assert(*locs != NULL);
+	for (Count i = 0; i < b->n; i++) {
+		Container *c = &b->cs[i];
+		Count base = c->key << 16;
+		if (c->bits == NULL) {
+			for (Count j = 0; j < c->card; j++)
+				n += location(x, base | c->array[j], &(*locs)[n]);
+			continue;
+		}
+		for (Count w = 0; w < BMWORDS; w++) {
+			for (Word bits = c->bits[w]; bits != 0; bits &= bits-1)
+				n += location(x, base | (w*64 + __builtin_ctzll(bits)), &(*locs)[n]);
+		}
+	}
+	pthread_mutex_unlock(&x->lock);
+	return n;
+}
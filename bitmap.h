@@ -0,0 +1,27 @@
+// bitmap.h ... interface to bitmap indexes
+// part of Multi-attribute Linear-hashed Files
+// See bitmap.c for details of BitmapIndex and Bitmap types and functions
+
+#ifndef BITMAP_H
+#define BITMAP_H 1
+
+typedef struct BitmapIndexRep *BitmapIndex;
+typedef struct BitmapRep *Bitmap;  // a compressed set of tuple positions
+
+#include "defs.h"
+#include "hashidx.h"
+#include "tuple.h"
+
+BitmapIndex bmapOpen(char *name, Count nattrs, Count attrs, Bool writer, Bool *stale);
+void bmapClose(BitmapIndex x);
+void bmapClear(BitmapIndex x);
+void bmapAddTuple(BitmapIndex x, IndexLoc loc, Tuple t);
+void bmapRemoveBucket(BitmapIndex x, PageID bucket);
+Bool bmapHas(BitmapIndex x, Count attr);
+Bitmap bmapLookup(BitmapIndex x, Count attr, char *val, Count len);
+Count bmapLocations(BitmapIndex x, Bitmap b, IndexLoc **locs);
+Bitmap bmapAnd(Bitmap a, Bitmap b);
+Count bmapCount(Bitmap b);
+void bmapFree(Bitmap b);
+
+#endif
@@ -0,0 +1,181 @@
+// bloom.c ... per-bucket Bloom filters on attribute values
+// part of Multi-attribute Linear-hashed Files
+// Lets selections skip bucket chains that can't hold a value
+
+#include <unistd.h>
+#include "defs.h"
+#include "bloom.h"
+#include "hash.h"
+
+// Each bucket has one filter of BLOOMBYTES per attribute, recording
+// every value of that attribute held anywhere in the bucket's chain.
+// A filter can say "definitely not here" but never the opposite, so
+// a missing bit means the whole chain can be skipped.
+// The filters live in memory while the relation is open and are kept
+// in RelName.bloom, which is only written when a writer closes:
+// - header: magic, clean flag, #attrs, #buckets
+// - then #buckets records of #attrs filters
+// A writer clears the clean flag on disk before changing anything, so
+// filters left behind by a crash (or still being updated by an open
+// writer) are never trusted; readers then do without them, and the
+// next writer rebuilds them from the pages.
+
+#define BLOOMMAGIC  0x626c6f6f  // "bloo"
+#define BLOOMBYTES  64          // bytes per filter (512 bits)
+#define BLOOMBITS   (8*BLOOMBYTES)
+#define BLOOMPROBES 4           // bits set per value
+
+typedef struct {
+	Count magic;    // BLOOMMAGIC
+	Count clean;    // filters match the relation
+	Count nattrs;   // filters per bucket
+	Count nbuckets; // buckets covered
+} BloomHeader;
+
+struct BloomRep {
+	FILE  *file;     // RelName.bloom
+	Bool   writer;   // write filters back on close
+	Count  nattrs;   // filters per bucket
+	Count  nbuckets; // buckets with filters
+	Count  size;     // buckets allocated
+	Byte  *bits;     // filters, bucket-major
+};
+
+// filter for attribute attr of bucket
+
+static Byte *filter(Bloom b, PageID bucket, Count attr)
+{
+	return b->bits + ((size_t)bucket*b->nattrs + attr)*BLOOMBYTES;
+}
+
+// bit positions for a value: double hashing, g_i = h1 + i*h2
+
+static void probes(char *val, Count len, Count *pos)
+{
+	Bits h1 = hash_any((unsigned char *)val, len);
+	Bits h2 = ((h1 >> 17) | (h1 << 15)) | 1;
+	for (int i = 0; i < BLOOMPROBES; i++)
+		pos[i] = (h1 + i*h2) % BLOOMBITS;
+}
+
+static void writeHeader(Bloom b, Bool clean)
+{
+	BloomHeader h = { BLOOMMAGIC, clean, b->nattrs, b->nbuckets };
+	ssize_t n = pwrite(fileno(b->file), &h, sizeof(h), 0);
+	assert(n == sizeof(h));
+}
+
+// open the filters for relation name, which has nbuckets buckets
+// writers get filters even if none could be loaded (*stale is then
+//   set, and the caller must re-add every tuple); readers get NULL
+//   if there are no trustworthy filters
+
+Bloom bloomOpen(char *name, Count nattrs, Count nbuckets, Bool writer, Bool *stale)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname,"%s.bloom",name);
+	FILE *f = fopen(fname, writer ? "r+" : "r");
+	if (f == NULL && writer) f = fopen(fname, "w+");
+	if (f == NULL) return NULL;
+
+	Bloom b = malloc(sizeof(struct BloomRep));
+	assert(b != NULL);
+	b->file = f;
+	b->writer = writer;
+	b->nattrs = nattrs;
+	b->nbuckets = b->size = nbuckets;
+	b->bits = calloc((size_t)nbuckets*nattrs, BLOOMBYTES);
+	assert(b->bits != NULL);
+
+	BloomHeader h;
+	Bool ok = fread(&h, sizeof(h), 1, f) == 1
+	       && h.magic == BLOOMMAGIC && h.clean
+	       && h.nattrs == nattrs && h.nbuckets == nbuckets;
+	if (ok) {
+		size_t n = fread(b->bits, BLOOMBYTES, (size_t)nbuckets*nattrs, f);
+		ok = (n == (size_t)nbuckets*nattrs);
+	}
+	if (!ok) memset(b->bits, 0, (size_t)nbuckets*nattrs*BLOOMBYTES);
+	*stale = !ok;
+	if (!writer) {
+		if (!ok) { bloomClose(b); return NULL; }
+		return b;
+	}
+	// on-disk filters are out of date until we close
+	writeHeader(b, FALSE);
+	fsync(fileno(f));
+	return b;
+}
+
+// save the filters (writers) and release them
+
+void bloomClose(Bloom b)
+{
+	if (b->writer) {
+		size_t n = (size_t)b->nbuckets*b->nattrs;
+		ssize_t len = pwrite(fileno(b->file), b->bits, n*BLOOMBYTES, sizeof(BloomHeader));
+		assert(len == n*BLOOMBYTES);
+		fsync(fileno(b->file));
+		writeHeader(b, TRUE);
+		fsync(fileno(b->file));
+	}
+	fclose(b->file);
+	free(b->bits);
+	free(b);
+}
+
+// add empty filters for buckets up to nbuckets
+// caller must make sure no-one else is using the filters
+
+void bloomGrow(Bloom b, Count nbuckets)
+{
+	if (nbuckets > b->size) {
+		Count size = 2*b->size;
+		if (size < nbuckets) size = nbuckets;
+		b->bits = realloc(b->bits, (size_t)size*b->nattrs*BLOOMBYTES);
+		assert(b->bits != NULL);
+		b->size = size;
+	}
+	for (; b->nbuckets < nbuckets; b->nbuckets++)
+		bloomClear(b, b->nbuckets);
+}
+
+// empty all filters for bucket
+
+void bloomClear(Bloom b, PageID bucket)
+{
+	memset(filter(b, bucket, 0), 0, b->nattrs*BLOOMBYTES);
+}
+
+// record each attribute value of tuple t in bucket's filters
+// callers adding to different buckets don't interfere
+
+void bloomAddTuple(Bloom b, PageID bucket, Tuple t)
+{
+	char *c = t;
+	for (Count a = 0; a < b->nattrs; a++) {
+		char *end = strchr(c, ',');
+		Count len = (end == NULL) ? strlen(c) : end - c;
+		Count pos[BLOOMPROBES];
+		probes(c, len, pos);
+		Byte *f = filter(b, bucket, a);
+		for (int i = 0; i < BLOOMPROBES; i++)
+			f[pos[i]/8] |= 1 << (pos[i]%8);
+		if (end == NULL) break;
+		c = end + 1;
+	}
+}
+
+// could bucket hold a tuple whose attribute attr is val (len bytes)?
+
+Bool bloomMayContain(Bloom b, PageID bucket, Count attr, char *val, Count len)
+{
+	if (bucket >= b->nbuckets || attr >= b->nattrs) return TRUE;
+	Count pos[BLOOMPROBES];
+	probes(val, len, pos);
+	Byte *f = filter(b, bucket, attr);
+	for (int i = 0; i < BLOOMPROBES; i++) {
+		if (!(f[pos[i]/8] & (1 << (pos[i]%8)))) return FALSE;
+	}
+	return TRUE;
+}
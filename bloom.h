@@ -0,0 +1,20 @@
+// bloom.h ... interface to per-bucket Bloom filters
+// part of Multi-attribute Linear-hashed Files
+// See bloom.c for details of Bloom type and functions
+
+#ifndef BLOOM_H
+#define BLOOM_H 1
+
+typedef struct BloomRep *Bloom;
+
+#include "defs.h"
+#include "tuple.h"
+
+Bloom bloomOpen(char *name, Count nattrs, Count nbuckets, Bool writer, Bool *stale);
+void bloomClose(Bloom b);
+void bloomGrow(Bloom b, Count nbuckets);
+void bloomClear(Bloom b, PageID bucket);
+void bloomAddTuple(Bloom b, PageID bucket, Tuple t);
+Bool bloomMayContain(Bloom b, PageID bucket, Count attr, char *val, Count len);
+
+#endif
@@ -0,0 +1,167 @@
+// btree.c ... in-memory B+-trees
+// part of Multi-attribute Linear-hashed Files
+// Ordered sets of items, for range scans over attribute values
+
+#include "defs.h"
+#include "btree.h"
+
+// Items are opaque pointers, ordered by the tree's comparison function
+// (which must not consider two different items equal). They are held
+// in the leaves, which are linked left to right, so a range is found
+// by one descent to its first item and then a walk along the leaves.
+// Interior nodes hold, for each child but the first, the smallest
+// item under it. Items are never removed; the tree is freed as a
+// whole, and the items themselves belong to the caller.
+
+#define BTORDER 64  // most items (leaf) or children (interior) per node
+
+typedef struct BTNode {
+	Bool   leaf;            // leaf or interior node
+	int    n;               // items (leaf) or children (interior)
+	void  *keys[BTORDER];   // items; interior: keys[i] is smallest under child i (i > 0)
+	struct BTNode *child[BTORDER];  // interior: subtrees
+	struct BTNode *next;    // leaf: next leaf to the right
+} BTNode;
+
+struct BTreeRep {
+	BTNode *root;
+	int (*cmp)(void *, void *);
+};
+
+static BTNode *newNode(Bool leaf)
+{
+	BTNode *n = malloc(sizeof(BTNode));
+	assert(n != NULL);
+	n->leaf = leaf;
+	n->n = 0;
+	n->next = NULL;
+	return n;
+}
+
+BTree newBTree(int (*cmp)(void *, void *))
+{
+	BTree t = malloc(sizeof(struct BTreeRep));
+	assert(t != NULL);
+	t->root = newNode(TRUE);
+	t->cmp = cmp;
+	return t;
+}
+
+static void freeNode(BTNode *n)
+{
+	if (!n->leaf) {
+		for (int i = 0; i < n->n; i++) freeNode(n->child[i]);
+	}
+	free(n);
+}
+
+void freeBTree(BTree t)
+{
+	freeNode(t->root);
+	free(t);
+}
+
+// position of the first item >= key in a leaf, or of the child of
+//   an interior node whose range holds key
+
+static int search(BTree t, BTNode *n, void *key)
+{
+	int lo = n->leaf ? 0 : 1, hi = n->n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (t->cmp(n->keys[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (n->leaf) return lo;
+	// keys[lo] >= key; key belongs under child lo-1 unless equal
+	if (lo < n->n && t->cmp(n->keys[lo], key) == 0) return lo;
+	return lo - 1;
+}
+
+// insert item under n; if n splits, returns the new right sibling
+//   (whose smallest item is in *sep)
+
+static BTNode *insert(BTree t, BTNode *n, void *item, void **sep)
+{
+	int i = search(t, n, item);
+	void *key = item;
+	BTNode *right = NULL;
+	if (!n->leaf) {
+		right = insert(t, n->child[i], item, &key);
+		if (right == NULL) return NULL;
+		i++;  // new child goes after child i
+	}
+	if (n->n < BTORDER) {
+		memmove(&n->keys[i+1], &n->keys[i], (n->n - i) * sizeof(void *));
+		n->keys[i] = key;
+		if (!n->leaf) {
+			memmove(&n->child[i+1], &n->child[i], (n->n - i) * sizeof(BTNode *));
+			n->child[i] = right;
+		}
+		n->n++;
+		return NULL;
+	}
+	// full: split into two halves, then add to the proper one
+	BTNode *sib = newNode(n->leaf);
+	int half = BTORDER / 2;
+	sib->n = BTORDER - half;
+	memcpy(sib->keys, &n->keys[half], sib->n * sizeof(void *));
+	if (!n->leaf) memcpy(sib->child, &n->child[half], sib->n * sizeof(BTNode *));
+	n->n = half;
+	if (n->leaf) {
+		sib->next = n->next;
+		n->next = sib;
+	}
+	BTNode *into = (i > half || (i == half && !n->leaf)) ? sib : n;
+	if (into == sib) i -= half;
+	memmove(&into->keys[i+1], &into->keys[i], (into->n - i) * sizeof(void *));
+	into->keys[i] = key;
+	if (!n->leaf) {
+		memmove(&into->child[i+1], &into->child[i], (into->n - i) * sizeof(BTNode *));
+		into->child[i] = right;
+	}
+	into->n++;
+	*sep = sib->keys[0];
+	return sib;
+}
+
+// add item to the tree
+
+void btInsert(BTree t, void *item)
+{
+	void *sep;
+	BTNode *right = insert(t, t->root, item, &sep);
+	if (right != NULL) {
+		// root split: grow a new root above the two halves
+		BTNode *root = newNode(FALSE);
+		root->n = 2;
+		root->child[0] = t->root;
+		root->child[1] = right;
+		root->keys[1] = sep;
+		t->root = root;
+	}
+}
+
+// position c at the first item >= key
+
+void btSeek(BTree t, void *key, BTCursor *c)
+{
+	BTNode *n = t->root;
+	while (!n->leaf) n = n->child[search(t, n, key)];
+	c->leaf = n;
+	c->pos = search(t, n, key);
+}
+
+// next item from cursor c, or NULL when there are no more
+
+void *btNext(BTCursor *c)
+{
+	while (c->leaf != NULL && c->pos == c->leaf->n) {
+		c->leaf = c->leaf->next;
+		c->pos = 0;
+	}
+	if (c->leaf == NULL) return NULL;
+	return c->leaf->keys[c->pos++];
+}
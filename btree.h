@@ -0,0 +1,24 @@
+// btree.h ... interface to in-memory B+-trees
+// part of Multi-attribute Linear-hashed Files
+// See btree.c for details of BTree type and functions
+
+#ifndef BTREE_H
+#define BTREE_H 1
+
+typedef struct BTreeRep *BTree;
+
+#include "defs.h"
+
+// position in a B+-tree, for scanning items in order
+typedef struct {
+	struct BTNode *leaf;  // leaf holding next item (NULL at end)
+	int pos;              // index of next item in leaf
+} BTCursor;
+
+BTree newBTree(int (*cmp)(void *, void *));
+void freeBTree(BTree t);
+void btInsert(BTree t, void *item);
+void btSeek(BTree t, void *key, BTCursor *c);
+void *btNext(BTCursor *c);
+
+#endif
@@ -0,0 +1,158 @@
+// cache.c ... query result cache
+// part of Multi-attribute Linear-hashed Files
+// Keeps the output of recent queries for re-use by later identical ones
+
+#include <pthread.h>
+#include "defs.h"
+#include "cache.h"
+#include "hash.h"
+
+// Entries are keyed on a string that identifies the query (relation,
+// its creation stamp, projection and selection, in normal form; see
+// queryKey() in exec.c) and tagged with the version of the relation
+// they were computed from.
+// Every change to a relation bumps its version, so an entry is only
+// used while the relation is still at that version; a stale entry is
+// simply replaced the next time the query is run. A relation created
+// again under the same name starts back at version 0, but has a new
+// stamp, so its queries never match entries for the old one.
+// The cache holds at most maxbytes of keys and results; the least
+// recently used entries are dropped to make room.
+
+#define CACHEHASH 1024  // hash table size
+
+typedef struct CacheEntry {
+	char  *key;       // query identifier
+	Count  version;   // relation version the results belong to
+	char  *results;   // query output
+	Count  len;       // bytes in results
+	struct CacheEntry *next;   // next in hash chain
+	struct CacheEntry *newer;  // LRU list neighbours
+	struct CacheEntry *older;
+} CacheEntry;
+
+struct QueryCacheRep {
+	Count  maxbytes;  // most bytes of keys+results held
+	Count  nbytes;    // bytes of keys+results held
+	CacheEntry *table[CACHEHASH];
+	CacheEntry *newest, *oldest;  // LRU list
+	pthread_mutex_t lock;
+};
+
+static int cacheHash(char *key)
+{
+	return hash_any((unsigned char *)key, strlen(key)) % CACHEHASH;
+}
+
+static Count entrySize(CacheEntry *e)
+{
+	return strlen(e->key) + 1 + e->len;
+}
+
+// make a cache holding up to maxbytes of query results
+
+QueryCache newQueryCache(Count maxbytes)
+{
+	QueryCache c = malloc(sizeof(struct QueryCacheRep));
+	assert(c != NULL);
+	c->maxbytes = maxbytes;
+	c->nbytes = 0;
+	memset(c->table, 0, sizeof(c->table));
+	c->newest = c->oldest = NULL;
+	pthread_mutex_init(&c->lock, NULL);
+	return c;
+}
+
+static void unlinkLRU(QueryCache c, CacheEntry *e)
+{
+	if (e->newer != NULL) e->newer->older = e->older; else c->newest = e->older;
+	if (e->older != NULL) e->older->newer = e->newer; else c->oldest = e->newer;
+}
+
+static void linkNewest(QueryCache c, CacheEntry *e)
+{
+	e->newer = NULL;
+	e->older = c->newest;
+	if (c->newest != NULL) c->newest->newer = e; else c->oldest = e;
+	c->newest = e;
+}
+
+// remove an entry from the cache and release it
+
+static void dropEntry(QueryCache c, CacheEntry *e)
+{
+	CacheEntry **p = &c->table[cacheHash(e->key)];
+	while (*p != e) p = &(*p)->next;
+	*p = e->next;
+	unlinkLRU(c, e);
+	c->nbytes -= entrySize(e);
+	free(e->key);
+	free(e->results);
+	free(e);
+}
+
+static CacheEntry *findEntry(QueryCache c, char *key)
+{
+	CacheEntry *e;
+	for (e = c->table[cacheHash(key)]; e != NULL; e = e->next) {
+		if (strcmp(e->key, key) == 0) break;
+	}
+	return e;
+}
+
+void freeQueryCache(QueryCache c)
+{
+	while (c->oldest != NULL) dropEntry(c, c->oldest);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+// if the results of query key at this version are cached, return
+//   a copy of them (*len bytes, to be free'd by the caller); else NULL
+
+char *cacheLookup(QueryCache c, char *key, Count version, Count *len)
+{
+	char *results = NULL;
+	pthread_mutex_lock(&c->lock);
+	CacheEntry *e = findEntry(c, key);
+	Bool hit = (e != NULL && e->version == version);
+	if (hit) {
+		unlinkLRU(c, e);
+		linkNewest(c, e);
+		// copied, so a slow reader doesn't hold up the cache
+		*len = e->len;
+		results = malloc(*len + 1);
+		assert(results != NULL);
+		memcpy(results, e->results, *len);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return results;
+}
+
+// remember the results (len bytes) of query key at this version
+// results too big for the cache are not kept
+
+void cacheStore(QueryCache c, char *key, Count version, char *results, Count len)
+{
+	Count size = strlen(key) + 1 + len;
+	pthread_mutex_lock(&c->lock);
+	CacheEntry *e = findEntry(c, key);
+	if (e != NULL) dropEntry(c, e);
+	if (size <= c->maxbytes) {
+		while (c->nbytes + size > c->maxbytes) dropEntry(c, c->oldest);
+		e = malloc(sizeof(CacheEntry));
+		assert(e != NULL);
+		e->key = copyString(key);
+		e->version = version;
+		e->results = malloc(len + 1);
+		assert(e->results != NULL);
+		memcpy(e->results, results, len);
+		e->len = len;
+		int h = cacheHash(key);
+		e->next = c->table[h];
+		c->table[h] = e;
+		linkNewest(c, e);
+		c->nbytes += size;
+	}
+	pthread_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,17 @@
+// cache.h ... interface to the query result cache
+// part of Multi-attribute Linear-hashed Files
+// See cache.c for details of QueryCache type and functions
+
+#ifndef CACHE_H
+#define CACHE_H 1
+
+typedef struct QueryCacheRep *QueryCache;
+
+#include "defs.h"
+
+QueryCache newQueryCache(Count maxbytes);
+void freeQueryCache(QueryCache c);
+char *cacheLookup(QueryCache c, char *key, Count version, Count *len);
+void cacheStore(QueryCache c, char *key, Count version, char *results, Count len);
+
+#endif
@@ -1,10 +1,22 @@
 // create.c ... create an empty Relation
 // part of Multi-attribute linear-hashed files
 // Ask a query on a named file
-// Usage:  ./create  [-v]  RelName  #attrs  #pages  ChoiceVector
+// Usage:  ./create  [-v]  [-p]  [-b]  [-i a1,a2,..]  [-o a1,a2,..]  [-g a1,a2,..]  [-m a1,a2,..]  [-s t1,t2,..]  RelName  #attrs  #pages  ChoiceVector
 // where #attrs = # of attributes in each tuple
 //	   #pages = initial (empty) pages in File
 //	   ChoiceVector = attr,bit:attr,bit:...
+//	   -p = grow the file by partial expansions
+//	   -b = keep per-bucket Bloom filters on attribute values
+//	   -i = keep secondary hash indexes on attributes a1,a2,.. (from 1)
+//	   -o = keep ordered indexes on attributes a1,a2,.., which also
+//	        answer prefix ('abc%') queries
+//	   -g = keep trigram indexes on attributes a1,a2,.., which narrow
+//	        down infix ('%abc%') queries
+//	   -m = keep bitmap indexes on attributes a1,a2,.., which suit
+//	        attributes with few distinct values
+//	   -s = attribute types t1,t2,.. (int, float or string, the
+//	        default); numbers are stored in binary, and can be
+//	        queried with ranges
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -12,9 +24,57 @@
 #include "util.h"
 #include "reln.h"
 
-#define USAGE "./create  [-v]  RelName  #attrs  #pages  ChoiceVector"
+#define USAGE "./create  [-v]  [-p]  [-b]  [-i a1,a2,..]  [-o a1,a2,..]  [-g a1,a2,..]  [-m a1,a2,..]  [-s t1,t2,..]  RelName  #attrs  #pages  ChoiceVector"
 
 
+// attributes in list "a1,a2,..." (numbered from 1), as a bit mask
+//   with bit a-1 for attribute a; an empty mask if list is NULL
+
+static Count attrList(char *list, int nattrs)
+{
+	Count mask = 0;
+	char *c = list;
+	while (c != NULL) {
+		int a = atoi(c);
+		if (a < 1 || a > nattrs) {
+			char err[MAXERRMSG];
+			sprintf(err, "Invalid indexed attribute: %d", a);
+			fatal(err);
+		}
+		mask |= 1 << (a-1);
+		if ((c = strchr(c, ',')) != NULL) c++;
+	}
+	return mask;
+}
+
+// attribute types in list "t1,t2,..." as TYPE_* values, two bits
+//   per attribute (see RELN_TYPE); attributes not listed are strings
+
+static Count typeList(char *list, int nattrs)
+{
+	static struct { char *name; Count type; } names[] = {
+		{ "string", TYPE_STRING }, { "int", TYPE_INT }, { "float", TYPE_FLOAT }
+	};
+	Count types = 0;
+	char *c = list;
+	for (int a = 0; c != NULL; a++) {
+		char *end = strchr(c, ',');
+		int len = (end == NULL) ? strlen(c) : end - c;
+		int t;
+		for (t = 0; t < 3; t++) {
+			if (strlen(names[t].name) == len && strncmp(c, names[t].name, len) == 0) break;
+		}
+		if (a >= nattrs || t == 3) {
+			char err[MAXERRMSG];
+			snprintf(err, MAXERRMSG, "Invalid type list: %s", list);
+			fatal(err);
+		}
+		types |= names[t].type << (2*a);
+		c = (end == NULL) ? NULL : end + 1;
+	}
+	return types;
+}
+
 // Main ... process args, create relation
 
 int main(int argc, char **argv)
@@ -23,23 +83,45 @@ int main(int argc, char **argv)
 	int nattrs;  // number of attributes in each tuple
 	int npages;  // initial number of pages
 	char err[MAXERRMSG];  // buffer for error messages
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	Count flags = 0;  // RELN_* options for the new relation
 	char *rname;  // name of table/file
 	char *attrs;   // number of attributes in tuples
 	char *pages;   // number of pages in data file
 	char *cv;	  // choice vector
+	char *indexed = NULL;  // attributes to index
+	char *ordered = NULL;  // attributes to give ordered indexes
+	char *grams = NULL;  // attributes to give trigram indexes
+	char *mapped = NULL;  // attributes to give bitmap indexes
+	char *schema = NULL;  // attribute types
 
 	// Process command-line args
 
 	if (argc < 2) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc < 6) fatal(USAGE);
-	    verbose = 1; rname = argv[2]; attrs = argv[3]; pages = argv[4]; cv = argv[5];
-	}
-	else {
-		if (argc < 5) fatal(USAGE);
-	    verbose = 0; rname = argv[1]; attrs = argv[2]; pages = argv[3]; cv = argv[4];
+	int arg = 1;
+	while (arg < argc && argv[arg][0] == '-') {
+		if (strcmp(argv[arg], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[arg], "-p") == 0)
+			flags |= RELN_PARTIAL;
+		else if (strcmp(argv[arg], "-b") == 0)
+			flags |= RELN_BLOOM;
+		else if (strcmp(argv[arg], "-i") == 0 && arg+1 < argc)
+			indexed = argv[++arg];
+		else if (strcmp(argv[arg], "-o") == 0 && arg+1 < argc)
+			ordered = argv[++arg];
+		else if (strcmp(argv[arg], "-g") == 0 && arg+1 < argc)
+			grams = argv[++arg];
+		else if (strcmp(argv[arg], "-m") == 0 && arg+1 < argc)
+			mapped = argv[++arg];
+		else if (strcmp(argv[arg], "-s") == 0 && arg+1 < argc)
+			schema = argv[++arg];
+		else
+			fatal(USAGE);
+		arg++;
 	}
+	if (argc - arg < 4) fatal(USAGE);
+	rname = argv[arg]; attrs = argv[arg+1]; pages = argv[arg+2]; cv = argv[arg+3];
 
 	// how many attributes in each tuple
 	nattrs = atoi(attrs);
@@ -48,6 +130,28 @@ int main(int argc, char **argv)
 		fatal(err);
 	}
 
+	// which attributes have secondary indexes (an ordered one will do
+	//   for exact matches too)
+	Count hashed = attrList(indexed, nattrs), sorted = attrList(ordered, nattrs);
+	Count trigrams = attrList(grams, nattrs);
+	for (int a = 0; a < nattrs; a++) {
+		if (sorted & (1 << a))
+			flags |= RELN_ORDER(a);
+		else if (hashed & (1 << a))
+			flags |= RELN_INDEX(a);
+		if (trigrams & (1 << a))
+			flags |= RELN_TRIGRAM(a);
+	}
+	Count bitmaps = attrList(mapped, nattrs);
+	// trigrams of numbers' stored form would be of no use
+	Count types = typeList(schema, nattrs);
+	for (int a = 0; a < nattrs; a++) {
+		if ((trigrams & (1 << a)) && RELN_TYPE(types, a) != TYPE_STRING) {
+			sprintf(err, "Trigram index on numeric attribute: %d", a+1);
+			fatal(err);
+		}
+	}
+
 	// how many initally empty pages
 	npages = atoi(pages);
 	if (npages < 1 || npages > 64) {
@@ -68,7 +172,7 @@ int main(int argc, char **argv)
 		sprintf(err, "Relation %s already exists", rname);
 		fatal(err);
 	}
-	if (newRelation(rname, nattrs, np, d, cv) != OK) {
+	if (newRelation(rname, nattrs, np, d, cv, flags, bitmaps, types) != OK) {
 		sprintf(err, "Problems while creating relation %s", rname);
 		fatal(err);
 	}
@@ -2,15 +2,19 @@
 // part of Multi-attribute linear-hashed files
 // Show tuples, bucket-by-bucket
 // Last modified by John Shepherd, July 2019
-// Usage:  ./stats  RelName
+// Usage:  ./dump  [-f format]  RelName
+// where format = text (default), length or binary (see output.c);
+//   only text output shows where buckets and overflow pages start
 
 #include "defs.h"
 #include "reln.h"
 #include "page.h"
+#include "output.h"
+#include "tuple.h"
 
-void showAllTuples(Page);
+void showAllTuples(Reln, Output, Page);
 
-#define USAGE "./dump  RelName"
+#define USAGE "./dump  [-f format]  RelName"
 
 // Main ... process args, scan data, show tuples
 
@@ -18,8 +22,14 @@ int main(int argc, char **argv)
 {
 	// process command-line args
 
-	if (argc < 2) fatal(USAGE);
-	char *relname = argv[1];
+	int format = OUT_TEXT;
+	int arg = 1;
+	if (arg+1 < argc && strcmp(argv[arg], "-f") == 0) {
+		if ((format = outputFormat(argv[arg+1])) < 0) fatal(USAGE);
+		arg += 2;
+	}
+	if (arg >= argc) fatal(USAGE);
+	char *relname = argv[arg];
 
 	// open relation and show stats
 
@@ -29,36 +39,46 @@ int main(int argc, char **argv)
 	if (r == NULL)
 		fatal("Can't open relation");
 
+	Output out = openOutput(1, format);
+	char line[MAXERRMSG];
 	for (Offset pid = 0; pid < npages(r); pid++) {
-		printf("Bucket[%d]\n",pid);
+		sprintf(line,"Bucket[%d]\n",pid);
+		putText(out,line);
 		// show tuples in data file
 		Page pg = getPage(dataFile(r),pid);
-		showAllTuples(pg);
+		showAllTuples(r,out,pg);
 		// show tuples in overflow pages
 		Page ovpg;  PageID ovp;
 		ovp = pageOvflow(pg);
 		while (ovp != NO_PAGE) {
-			printf("Ovflow->\n");
+			putText(out,"Ovflow->\n");
 			ovpg = getPage(ovflowFile(r), ovp);
-			showAllTuples(ovpg);
+			showAllTuples(r,out,ovpg);
 			ovp = pageOvflow(ovpg);
 			free(ovpg);
 		}
 		free(pg);
 	}
+	if (closeOutput(out) != OK) fatal("Can't write tuples");
 	closeRelation(r);
 
 	return 0;
 }
 
 // scan all tuples in Page
+// numbers are stored in binary, and shown as text
 
-void showAllTuples(Page pg)
+void showAllTuples(Reln r, Output out, Page pg)
 {
 		Count ntups = pageNTuples(pg);
 		char *c = pageData(pg);
+		char text[MAXTEXTLEN];
 		for (int i = 0; i < ntups; i++) {
-			printf("%s\n", c);
-			c += strlen(c) + 1;
+			Count len = strlen(c);
+			if (types(r) == 0)
+				putTuple(out, c, len);
+			else
+				putTuple(out, text, tupleText(r, c, len, text));
+			c += len + 1;
 		}
 }
@@ -0,0 +1,316 @@
+// exec.c ... run a query against an open relation
+// part of Multi-attribute Linear-hashed Files
+// Shared by the query command and the query server
+
+#include <ctype.h>
+#include "defs.h"
+#include "exec.h"
+#include "reln.h"
+#include "select.h"
+#include "project.h"
+#include "tuple.h"
+#include "output.h"
+#include "aggregate.h"
+
+// next word of a query line, which may be enclosed in '...'
+// the word is terminated in place; *line moves past it
+
+static char *nextWord(char **line)
+{
+	char *c = *line;
+	while (isspace((unsigned char)*c)) c++;
+	if (*c == '\0') return NULL;
+	char *word;
+	if (*c == '\'') {
+		word = ++c;
+		c = strchr(c, '\'');
+		if (c == NULL) return NULL;
+	}
+	else {
+		word = c;
+		while (*c != '\0' && !isspace((unsigned char)*c)) c++;
+	}
+	if (*c != '\0') *c++ = '\0';
+	*line = c;
+	return word;
+}
+
+// split a query line  'a1,a3,..' from RelName where 'v1,v2,...'
+//   into its parts (quotes are optional)
+// line is modified; the parts point into it
+
+Status parseQuery(char *line, char **attrs, char **rname, char **vals)
+{
+	char *from, *where;
+	if ((*attrs = nextWord(&line)) == NULL) return ~OK;
+	if ((from = nextWord(&line)) == NULL || strcmp(from, "from") != 0) return ~OK;
+	if ((*rname = nextWord(&line)) == NULL) return ~OK;
+	if ((where = nextWord(&line)) == NULL || strcmp(where, "where") != 0) return ~OK;
+	if ((*vals = nextWord(&line)) == NULL) return ~OK;
+	if (nextWord(&line) != NULL) return ~OK;
+	return OK;
+}
+
+// text form of tuple t (*len bytes) from r's pages, which is t
+//   itself unless r has numeric attributes (see tuple.c)
+// buf must hold MAXTEXTLEN bytes
+
+static char *asText(Reln r, char *t, Count *len, char *buf)
+{
+	if (types(r) == 0) return t;
+	*len = tupleText(r, t, *len, buf);
+	return buf;
+}
+
+// describe on f how the selection vals on r would be done (see
+//   explainSelection() in select.c), without reading any tuples
+
+Status explainQuery(Reln r, char *vals, FILE *f, char *err)
+{
+	Selection s = startSelection(r, vals);
+	if (s == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid selection: %s", vals);
+		return ~OK;
+	}
+	explainSelection(s, f);
+	closeSelection(s);
+	return OK;
+}
+
+// find tuples in r matching vals and write their projections on
+//   attrs to out; aggregate projections (see aggregate.c) are
+//   computed as the tuples are scanned, and only the results written
+// counts that bitmap indexes can give (see select.c) need no scan
+// candidate buckets are scanned by nthreads threads (see select.c)
+// nothing is written if the query is invalid; err then explains why
+// results stop early, and err explains why, if a projected tuple
+//   would be longer than MAXTEXTLEN (attributes can be repeated)
+
+Status execQuery(Reln r, char *attrs, char *vals, Count nthreads, Bool ordered, Output out, char *err)
+{
+	Selection s;  // handle on the selection
+	Projection p;  // handle on the projection
+	Tuple t;  // tuple pointer
+	Count len;
+	Status ok = OK;
+
+	if ((s = startParallelSelection(r, vals, nthreads, ordered)) == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid selection: %s", vals);
+		return ~OK;
+	}
+	if (isAggregate(attrs)) {
+		Aggregate a = startAggregate(r, attrs);
+		if (a == NULL) {
+			snprintf(err, MAXERRMSG, "Invalid aggregate: %s", attrs);
+			closeSelection(s);
+			return ~OK;
+		}
+		Count n;
+		char text[MAXTEXTLEN];
+		if (countsOnly(a) && selectionCount(s, &n))
+			aggregateCount(a,n);
+		else {
+			while ((t = getNextTupleSpan(s, &len)) != NULL) {
+				t = asText(r,t,&len,text);
+				aggregateTuple(a,t,len);
+			}
+		}
+		putAggregates(a,out);
+		closeAggregate(a);
+		closeSelection(s);
+		return OK;
+	}
+	if ((p = startProjection(r, attrs)) == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid projection: %s", attrs);
+		closeSelection(s);
+		return ~OK;
+	}
+
+	// tuples are borrowed from the scan, so nothing is copied
+	//   except (for real projections) the selected fields
+	char tup[MAXTEXTLEN], text[MAXTEXTLEN];
+	Bool all = projectsAll(p);
+	while ((t = getNextTupleSpan(s, &len)) != NULL) {
+		t = asText(r,t,&len,text);
+		if (all)
+			putTuple(out,t,len);
+		else if (projectSpan(p,t,&len,tup,sizeof(tup)) == OK)
+			putTuple(out,tup,len);
+		else {
+			snprintf(err, MAXERRMSG, "Projected tuple too long: %s", attrs);
+			ok = ~OK;
+			break;
+		}
+	}
+
+	closeProjection(p);
+	closeSelection(s);
+	return ok;
+}
+
+// aggregate version of execBatch(): one set of groups per query
+
+static Status batchAggregates(Reln r, char *attrs, char **vals, Count nq, Output *outs, Count *bad, char *err)
+{
+	Aggregate *aggs = malloc(nq * sizeof(Aggregate));
+	assert(aggs != NULL);
+	for (Count i = 0; i < nq; i++) {
+		if ((aggs[i] = startAggregate(r, attrs)) == NULL) {
+			snprintf(err, MAXERRMSG, "Invalid aggregate: %s", attrs);
+			while (i > 0) closeAggregate(aggs[--i]);
+			free(aggs);
+			return ~OK;
+		}
+	}
+	MultiSelection m = startMultiSelection(r, vals, nq, bad);
+	if (m == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid selection: %s", vals[*bad]);
+		for (Count i = 0; i < nq; i++) closeAggregate(aggs[i]);
+		free(aggs);
+		return ~OK;
+	}
+	Bool *matches = malloc((nq+1) * sizeof(Bool));
+	assert(matches != NULL);
+	Tuple t;
+	char text[MAXTEXTLEN];
+	while ((t = getNextMultiTuple(m, matches)) != NULL) {
+		Count len = strlen(t);
+		char *tt = asText(r,t,&len,text);
+		for (Count i = 0; i < nq; i++) {
+			if (matches[i]) aggregateTuple(aggs[i],tt,len);
+		}
+		free(t);
+	}
+	for (Count i = 0; i < nq; i++) {
+		putAggregates(aggs[i],outs[i]);
+		closeAggregate(aggs[i]);
+	}
+	free(matches);
+	free(aggs);
+	closeMultiSelection(m);
+	return OK;
+}
+
+// run a batch of nq selections (vals[i]) on r with shared bucket scans,
+//   writing the projections on attrs of query i's results to outs[i]
+// each bucket chain needed by any of the queries is read once
+// nothing is written if the projection or a selection is invalid; err
+//   then explains why, and for a selection *bad is set to its index
+// results stop early, as for execQuery(), if a projected tuple is too long
+
+Status execBatch(Reln r, char *attrs, char **vals, Count nq, Output *outs, Count *bad, char *err)
+{
+	MultiSelection m;  // handle on the selections
+	Projection p;  // handle on the projection
+	Tuple t;  // tuple pointer
+	Status ok = OK;
+
+	if (isAggregate(attrs))
+		return batchAggregates(r, attrs, vals, nq, outs, bad, err);
+	if ((p = startProjection(r, attrs)) == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid projection: %s", attrs);
+		return ~OK;
+	}
+	if ((m = startMultiSelection(r, vals, nq, bad)) == NULL) {
+		snprintf(err, MAXERRMSG, "Invalid selection: %s", vals[*bad]);
+		closeProjection(p);
+		return ~OK;
+	}
+
+	char tup[MAXTEXTLEN], text[MAXTEXTLEN];
+	Bool *matches = malloc((nq+1) * sizeof(Bool));
+	assert(matches != NULL);
+	while ((t = getNextMultiTuple(m, matches)) != NULL) {
+		Count len = strlen(t);
+		char *res = asText(r,t,&len,text);
+		if (!projectsAll(p)) {
+			if (projectSpan(p,res,&len,tup,sizeof(tup)) != OK) {
+				snprintf(err, MAXERRMSG, "Projected tuple too long: %s", attrs);
+				free(t);
+				ok = ~OK;
+				break;
+			}
+			res = tup;
+		}
+		for (Count i = 0; i < nq; i++) {
+			if (matches[i]) putTuple(outs[i],res,len);
+		}
+		free(t);
+	}
+
+	free(matches);
+	closeMultiSelection(m);
+	closeProjection(p);
+	return ok;
+}
+
+// identify a query in normal form, for the result cache
+// selection values are padded out with '?' to one per attribute, and
+//   values made up only of '%' (which match anything) become '?'
+// the output format is part of the key, since results are kept formatted
+// returns a malloc'd string  format \n rname \n stamp \n attrs \n v1,v2,...
+
+static char *queryKey(Reln r, int format, char *rname, char *attrs, char *vals)
+{
+	Count size = strlen(rname) + strlen(attrs) + strlen(vals) + 2*nattrs(r) + 32;
+	char *key = malloc(size);
+	assert(key != NULL);
+	// the stamp tells apart relations created again under the same name
+	sprintf(key, "%d\n%s\n%u\n%s\n", format, rname, stamp(r), attrs);
+	char *k = key + strlen(key);
+	char *v = vals;
+	for (Count i = 0; i < nattrs(r); i++) {
+		// empty values are skipped, as by startSelection()
+		while (*v == ',') v++;
+		char *end = strchr(v, ',');
+		Count len = (end == NULL) ? strlen(v) : end - v;
+		Bool any = TRUE;
+		for (Count j = 0; j < len; j++) {
+			if (v[j] != '%') any = FALSE;
+		}
+		if (i > 0) *k++ = ',';
+		if (len == 0 || any)
+			*k++ = '?';
+		else {
+			memcpy(k, v, len);
+			k += len;
+		}
+		v += len;
+	}
+	*k = '\0';
+	return key;
+}
+
+// as execQuery(), but re-use the results of an identical query on
+//   the same version of r if cache holds them (and add them if not)
+
+Status execCachedQuery(QueryCache cache, Reln r, char *rname, char *attrs, char *vals,
+                       Count nthreads, Output out, char *err)
+{
+	Count v = version(r);
+	char *key = queryKey(r, formatOf(out), rname, attrs, vals);
+	Count hitlen;
+	char *hit = cacheLookup(cache, key, v, &hitlen);
+	if (hit != NULL) {
+		putBytes(out, hit, hitlen);
+		free(hit);
+		free(key);
+		return OK;
+	}
+	// ordered, so a cached result reads the same as a fresh one
+	char *results = NULL;
+	size_t len = 0;
+	FILE *buf = open_memstream(&results, &len);
+	assert(buf != NULL);
+	Output o = openOutputFile(buf, formatOf(out));
+	Status ok = execQuery(r, attrs, vals, nthreads, TRUE, o, err);
+	closeOutput(o);
+	fclose(buf);
+	if (ok == OK) {
+		putBytes(out, results, len);
+		cacheStore(cache, key, v, results, len);
+	}
+	free(results);
+	free(key);
+	return ok;
+}
@@ -0,0 +1,26 @@
+// exec.h ... interface to query execution
+// part of Multi-attribute Linear-hashed Files
+// See exec.c for details of functions
+
+#ifndef EXEC_H
+#define EXEC_H 1
+
+#include "defs.h"
+#include "reln.h"
+#include "cache.h"
+#include "output.h"
+
+// Unix domain socket used by mlhd/mlq unless -s is given
+#define MLHD_SOCKET "mlhd.sock"
+#define MAXQUERYLEN (2*MAXTUPLEN+MAXRELNAME+32)
+// ends the length-prefixed results of a query (no tuple is that long)
+#define MLHD_END    0xffffffff
+
+Status parseQuery(char *line, char **attrs, char **rname, char **vals);
+Status explainQuery(Reln r, char *vals, FILE *f, char *err);
+Status execQuery(Reln r, char *attrs, char *vals, Count nthreads, Bool ordered, Output out, char *err);
+Status execCachedQuery(QueryCache cache, Reln r, char *rname, char *attrs, char *vals,
+                       Count nthreads, Output out, char *err);
+Status execBatch(Reln r, char *attrs, char **vals, Count nq, Output *outs, Count *bad, char *err);
+
+#endif
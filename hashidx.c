@@ -0,0 +1,627 @@
+// hashidx.c ... secondary hash indexes on attribute values
+// part of Multi-attribute Linear-hashed Files
+// Map each value of an indexed attribute to where its tuples are
+
+#include <pthread.h>
+#include <unistd.h>
+#include "defs.h"
+#include "hashidx.h"
+#include "hash.h"
+#include "btree.h"
+
+// An index on attribute a maps every value of a held in the relation
+// to the locations (bucket, page, slot) of the tuples with that value.
+// Indexes on all the chosen attributes share one hash table, keyed
+// on (attribute, value). Entries for attributes with ordered indexes
+// are also kept in a B+-tree (see btree.c), ordered on (attribute,
+// value), so all the values starting with a prefix are found by one
+// range scan.
+// A trigram index on attribute a has an entry for every 3-byte
+// substring (trigram) of a's values, listing the tuples whose value
+// holds it; its entries are kept alongside the others, with attribute
+// a+GRAMKEY. A pattern such as '%abcd%' can only match tuples listed
+// under all of its trigrams (abc, bcd), so the lists are intersected
+// to find the few tuples worth checking.
+// Like the Bloom filters (see bloom.c), a writer keeps the indexes in
+// memory while the relation is open, and saves them in RelName.hidx
+// when it closes, sorted on (attribute, value):
+// - header: magic, clean flag, #attrs, indexed attributes, ordered
+//   ones, trigram-indexed ones, #entries, #fences, offset of fences
+// - per entry: attribute, value length, #locations, the value, and
+//   its locations
+// - fences: the offset, attribute, length and value of every
+//   HIDXFANOUT'th entry
+// Readers don't load the entries: they keep just the fences, find
+// the run of entries that could hold a value (or prefix) by binary
+// search, and read only that part of the file, so a lookup costs a
+// few reads however large the index is. (The file is, in effect, a
+// bulk-loaded B+-tree with one level above the leaves.)
+// A writer clears the clean flag on disk before changing anything, so
+// an index left behind by a crash (or still being updated by an open
+// writer) is never trusted; readers then do without it, and the next
+// writer rebuilds it from the pages.
+// Locations move when a bucket is split, so a split removes the
+// entries for its buckets' old tuples and adds them again as the
+// tuples are placed.
+
+#define HIDXMAGIC 0x68696478  // "hidx"
+#define HIDXSIZE  1024        // initial hash table size
+#define HIDXFANOUT 32         // saved entries per fence
+#define GRAMKEY   0x100       // added to attribute of trigram entries
+#define GRAMLEN   3           // bytes per trigram
+
+typedef struct {
+	Count magic;    // HIDXMAGIC
+	Count clean;    // index matches the relation
+	Count nattrs;   // attributes in relation
+	Count attrs;    // bit a set if attribute a is indexed
+	Count ordered;  // bit a set if attribute a's index is ordered
+	Count grams;    // bit a set if attribute a has a trigram index
+	Count nentries; // (attribute, value) entries
+	Count nfences;  // fences
+	Count fenceoff; // offset of fences in file
+} HashIndexHeader;
+
+typedef struct Entry {
+	Count     attr;   // attribute
+	Count     len;    // value length
+	char     *val;    // value (not '\0'-terminated)
+	Bits      hash;   // hash of value
+	Count     nlocs;  // locations in use
+	Count     size;   // locations allocated
+	IndexLoc *locs;   // where tuples with this value are
+	Count     cleared;  // last removal pass that cleaned locs
+	struct Entry *next;  // next in hash chain
+} Entry;
+
+// start of a run of saved entries
+typedef struct {
+	Count off;     // offset in file of first entry
+	Entry key;     // its attribute and value
+} Fence;
+
+struct HashIndexRep {
+	FILE   *file;     // RelName.hidx
+	Bool    writer;   // write index back on close
+	Count   nattrs;   // attributes in relation
+	Count   attrs;    // bit a set if attribute a is indexed
+	Count   ordered;  // bit a set if attribute a's index is ordered
+	Count   grams;    // bit a set if attribute a has a trigram index
+	Count   nbuckets; // hash table size
+	Count   nentries; // entries in table
+	Entry **table;    // entries by hash of value
+	BTree   tree;     // entries of ordered attributes, in order
+	Count   pass;     // removal passes so far
+	Count   nfences;  // readers: fences of saved entries
+	Fence  *fences;
+	Count   fenceoff; // readers: end of saved entries
+	pthread_mutex_t lock;  // inserters in different buckets share the table
+};
+
+static void writeHeader(HashIndex x, Bool clean)
+{
+	HashIndexHeader h = { HIDXMAGIC, clean, x->nattrs, x->attrs, x->ordered,
+	                      x->grams, x->nentries, x->nfences, x->fenceoff };
+	ssize_t n = pwrite(fileno(x->file), &h, sizeof(h), 0);
+	assert(n == sizeof(h));
+}
+
+// entry for attr = val (len bytes); created if create is set
+
+static Entry *findEntry(HashIndex x, Count attr, char *val, Count len, Bool create)
+{
+	Bits h = hash_any((unsigned char *)val, len) ^ attr;
+	Entry *e;
+	for (e = x->table[h % x->nbuckets]; e != NULL; e = e->next) {
+		if (e->hash == h && e->attr == attr && e->len == len
+		    && memcmp(e->val, val, len) == 0)
+			return e;
+	}
+	if (!create) return NULL;
+	e = malloc(sizeof(Entry));
+	assert(e != NULL);
+	e->attr = attr;
+	e->len = len;
+	e->val = malloc(len + 1);
+	assert(e->val != NULL);
+	memcpy(e->val, val, len);
+	e->hash = h;
+	e->nlocs = e->size = 0;
+	e->locs = NULL;
+	e->cleared = 0;
+	e->next = x->table[h % x->nbuckets];
+	x->table[h % x->nbuckets] = e;
+	if (hindexOrdered(x, attr)) btInsert(x->tree, e);
+	if (++x->nentries > x->nbuckets) {
+		// double the table once entries outnumber its slots
+		Count n = 2*x->nbuckets;
+		Entry **table = calloc(n, sizeof(Entry *));
+		assert(table != NULL);
+		for (Count i = 0; i < x->nbuckets; i++) {
+			Entry *next;
+			for (Entry *f = x->table[i]; f != NULL; f = next) {
+				next = f->next;
+				f->next = table[f->hash % n];
+				table[f->hash % n] = f;
+			}
+		}
+		free(x->table);
+		x->table = table;
+		x->nbuckets = n;
+	}
+	return e;
+}
+
+static void addLoc(Entry *e, IndexLoc loc)
+{
+	if (e->nlocs == e->size) {
+		e->size = (e->size == 0) ? 4 : 2*e->size;
+		e->locs = realloc(e->locs, e->size * sizeof(IndexLoc));
+		assert(e->locs != NULL);
+	}
+	e->locs[e->nlocs++] = loc;
+}
+
+// order on entries: by attribute, then value
+
+static int cmpEntry(void *a, void *b)
+{
+	Entry *x = a, *y = b;
+	if (x->attr != y->attr) return (x->attr < y->attr) ? -1 : 1;
+	Count n = (x->len < y->len) ? x->len : y->len;
+	int cmp = memcmp(x->val, y->val, n);
+	if (cmp != 0) return cmp;
+	return (x->len < y->len) ? -1 : (x->len > y->len);
+}
+
+static int cmpEntryPtr(const void *a, const void *b)
+{
+	return cmpEntry(*(Entry **)a, *(Entry **)b);
+}
+
+// read the attribute, value (into val) and #locations of the saved
+//   entry at the current position in the file
+// FALSE if there isn't a complete one
+
+static Bool readEntryHead(HashIndex x, Entry *e, char *val)
+{
+	Count hdr[3];  // attribute, length, #locations
+	if (fread(hdr, sizeof(Count), 3, x->file) != 3) return FALSE;
+	if ((hdr[0] & ~GRAMKEY) >= x->nattrs || hdr[1] > MAXTUPLEN) return FALSE;
+	e->attr = hdr[0]; e->len = hdr[1]; e->nlocs = hdr[2];
+	e->val = val;
+	return fread(val, 1, e->len, x->file) == e->len;
+}
+
+// writers: read all the saved entries into the hash table (and tree)
+// FALSE if they're missing or incomplete
+
+static Bool loadEntries(HashIndex x, Count nentries)
+{
+	for (Count i = 0; i < nentries; i++) {
+		Entry h;
+		char val[MAXTUPLEN];
+		if (!readEntryHead(x, &h, val)) return FALSE;
+		Entry *e = findEntry(x, h.attr, val, h.len, TRUE);
+		e->size = e->nlocs = h.nlocs;
+		e->locs = malloc((e->size+1) * sizeof(IndexLoc));
+		assert(e->locs != NULL);
+		if (fread(e->locs, sizeof(IndexLoc), e->nlocs, x->file) != e->nlocs)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+// readers: read the fences; FALSE if they're missing or incomplete
+
+static Bool loadFences(HashIndex x, HashIndexHeader *h)
+{
+	x->fenceoff = h->fenceoff;
+	x->fences = malloc((h->nfences+1) * sizeof(Fence));
+	assert(x->fences != NULL);
+	if (fseek(x->file, h->fenceoff, SEEK_SET) != 0) return FALSE;
+	for (x->nfences = 0; x->nfences < h->nfences; x->nfences++) {
+		Fence *f = &x->fences[x->nfences];
+		Count hdr[3];  // offset, attribute, length
+		if (fread(hdr, sizeof(Count), 3, x->file) != 3 || hdr[2] > MAXTUPLEN)
+			return FALSE;
+		f->off = hdr[0];
+		f->key.attr = hdr[1];
+		f->key.len = hdr[2];
+		f->key.val = malloc(hdr[2] + 1);
+		assert(f->key.val != NULL);
+		if (fread(f->key.val, 1, hdr[2], x->file) != hdr[2]) {
+			free(f->key.val);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// open the indexes on attributes attrs (bit a for attribute a) of
+//   relation name; those in ordered also answer prefix lookups
+// attributes in grams have trigram indexes
+// writers get an index even if none could be loaded (*stale is then
+//   set, and the caller must re-add every tuple); readers get NULL
+//   if there is no trustworthy index
+
+HashIndex hindexOpen(char *name, Count nattrs, Count attrs, Count ordered, Count grams, Bool writer, Bool *stale)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname,"%s.hidx",name);
+	FILE *f = fopen(fname, writer ? "r+" : "r");
+	if (f == NULL && writer) f = fopen(fname, "w+");
+	if (f == NULL) return NULL;
+
+	HashIndex x = malloc(sizeof(struct HashIndexRep));
+	assert(x != NULL);
+	x->file = f;
+	x->writer = writer;
+	x->nattrs = nattrs;
+	x->attrs = attrs;
+	x->ordered = ordered;
+	x->grams = grams;
+	x->nbuckets = HIDXSIZE;
+	x->nentries = 0;
+	x->table = calloc(x->nbuckets, sizeof(Entry *));
+	assert(x->table != NULL);
+	x->tree = newBTree(cmpEntry);
+	x->nfences = x->fenceoff = 0;
+	x->fences = NULL;
+	x->pass = 0;
+	pthread_mutex_init(&x->lock, NULL);
+
+	HashIndexHeader h;
+	Bool ok = fread(&h, sizeof(h), 1, f) == 1
+	       && h.magic == HIDXMAGIC && h.clean
+	       && h.nattrs == nattrs && h.attrs == attrs && h.ordered == ordered
+	       && h.grams == grams;
+	if (ok) ok = writer ? loadEntries(x, h.nentries) : loadFences(x, &h);
+	if (!ok) hindexClear(x);
+	*stale = !ok;
+	if (!writer) {
+		if (!ok) { hindexClose(x); return NULL; }
+		return x;
+	}
+	// on-disk index is out of date until we close
+	writeHeader(x, FALSE);
+	fsync(fileno(f));
+	return x;
+}
+
+// writers: save the entries in order, with their fences
+// entries whose tuples have all moved away are dropped
+
+static void saveEntries(HashIndex x)
+{
+	Entry **es = malloc((x->nentries+1) * sizeof(Entry *));
+	assert(es != NULL);
+	Count n = 0;
+	for (Count i = 0; i < x->nbuckets; i++) {
+		for (Entry *e = x->table[i]; e != NULL; e = e->next) {
+			if (e->nlocs > 0) es[n++] = e;
+		}
+	}
+	qsort(es, n, sizeof(Entry *), cmpEntryPtr);
+
+	Count nfences = (n + HIDXFANOUT-1) / HIDXFANOUT;
+	Count *offs = malloc((nfences+1) * sizeof(Count));
+	assert(offs != NULL);
+	fseek(x->file, sizeof(HashIndexHeader), SEEK_SET);
+	for (Count i = 0; i < n; i++) {
+		Entry *e = es[i];
+		if (i % HIDXFANOUT == 0) offs[i / HIDXFANOUT] = ftell(x->file);
+		Count hdr[3] = { e->attr, e->len, e->nlocs };
+		fwrite(hdr, sizeof(Count), 3, x->file);
+		fwrite(e->val, 1, e->len, x->file);
+		fwrite(e->locs, sizeof(IndexLoc), e->nlocs, x->file);
+	}
+	x->fenceoff = ftell(x->file);
+	for (Count i = 0; i < nfences; i++) {
+		Entry *e = es[i * HIDXFANOUT];
+		Count hdr[3] = { offs[i], e->attr, e->len };
+		fwrite(hdr, sizeof(Count), 3, x->file);
+		fwrite(e->val, 1, e->len, x->file);
+	}
+	int ok = fflush(x->file);
+	assert(ok == 0);
+	ok = ftruncate(fileno(x->file), ftell(x->file));
+	assert(ok == 0);
+	fsync(fileno(x->file));
+	x->nentries = n;
+	x->nfences = nfences;
+	writeHeader(x, TRUE);
+	fsync(fileno(x->file));
+	free(offs);
+	free(es);
+}
+
+// save the index (writers) and release it
+
+void hindexClose(HashIndex x)
+{
+	if (x->writer) saveEntries(x);
+	hindexClear(x);
+	fclose(x->file);
+	free(x->table);
+	freeBTree(x->tree);
+	pthread_mutex_destroy(&x->lock);
+	free(x);
+}
+
+// remove every entry
+
+void hindexClear(HashIndex x)
+{
+	for (Count i = 0; i < x->nbuckets; i++) {
+		Entry *next;
+		for (Entry *e = x->table[i]; e != NULL; e = next) {
+			next = e->next;
+			free(e->val);
+			free(e->locs);
+			free(e);
+		}
+		x->table[i] = NULL;
+	}
+	x->nentries = 0;
+	if (x->fences != NULL) {
+		for (Count i = 0; i < x->nfences; i++) free(x->fences[i].key.val);
+		free(x->fences);
+		x->fences = NULL;
+	}
+	x->nfences = 0;
+	freeBTree(x->tree);
+	x->tree = newBTree(cmpEntry);
+}
+
+// is attribute attr indexed?
+
+Bool hindexHas(HashIndex x, Count attr)
+{
+	return attr < x->nattrs && (x->attrs & (1 << attr)) != 0;
+}
+
+// does attribute attr have an ordered index?
+
+Bool hindexOrdered(HashIndex x, Count attr)
+{
+	return attr < x->nattrs && (x->ordered & (1 << attr)) != 0;
+}
+
+// does attribute attr have a trigram index?
+
+Bool hindexTrigrams(HashIndex x, Count attr)
+{
+	return attr < x->nattrs && (x->grams & (1 << attr)) != 0;
+}
+
+// is the trigram at val[i] the first occurrence of it in val?
+
+static Bool firstGram(char *val, Count i)
+{
+	for (Count j = 0; j < i; j++) {
+		if (memcmp(val+j, val+i, GRAMLEN) == 0) return FALSE;
+	}
+	return TRUE;
+}
+
+// remove the locations in bucket from entry e (if there is one and
+//   it hasn't already been done in this removal pass)
+
+static void removeBucket(HashIndex x, Entry *e, PageID bucket)
+{
+	if (e == NULL || e->cleared == x->pass) return;
+	e->cleared = x->pass;
+	Count kept = 0;
+	for (Count i = 0; i < e->nlocs; i++) {
+		if (e->locs[i].bucket != bucket) e->locs[kept++] = e->locs[i];
+	}
+	e->nlocs = kept;
+}
+
+// record that tuple t is at loc, under each of its indexed values
+//   (and each distinct trigram of its trigram-indexed ones)
+
+void hindexAddTuple(HashIndex x, IndexLoc loc, Tuple t)
+{
+	pthread_mutex_lock(&x->lock);
+	char *c = t;
+	for (Count a = 0; a < x->nattrs; a++) {
+		char *end = strchr(c, ',');
+		Count len = (end == NULL) ? strlen(c) : end - c;
+		if (hindexHas(x, a)) addLoc(findEntry(x, a, c, len, TRUE), loc);
+		if (hindexTrigrams(x, a)) {
+			for (Count i = 0; i + GRAMLEN <= len; i++) {
+				if (firstGram(c, i))
+					addLoc(findEntry(x, a+GRAMKEY, c+i, GRAMLEN, TRUE), loc);
+			}
+		}
+		if (end == NULL) break;
+		c = end + 1;
+	}
+	pthread_mutex_unlock(&x->lock);
+}
+
+// forget where the n tuples ts, all of bucket's tuples, are
+// used when a bucket's tuples are taken out to be redistributed
+// each entry's list is only cleaned once, however many of the
+//   tuples share its value (or trigram)
+
+void hindexRemoveTuples(HashIndex x, PageID bucket, Tuple *ts, Count n)
+{
+	pthread_mutex_lock(&x->lock);
+	x->pass++;
+	for (Count k = 0; k < n; k++) {
+		char *c = ts[k];
+		for (Count a = 0; a < x->nattrs; a++) {
+			char *end = strchr(c, ',');
+			Count len = (end == NULL) ? strlen(c) : end - c;
+			if (hindexHas(x, a)) removeBucket(x, findEntry(x, a, c, len, FALSE), bucket);
+			if (hindexTrigrams(x, a)) {
+				for (Count i = 0; i + GRAMLEN <= len; i++)
+					removeBucket(x, findEntry(x, a+GRAMKEY, c+i, GRAMLEN, FALSE), bucket);
+			}
+			if (end == NULL) break;
+			c = end + 1;
+		}
+	}
+	pthread_mutex_unlock(&x->lock);
+}
+
+// ordering on locations that follows a scan of the buckets: by bucket,
+//   then along the chain (data page first; overflow pages are always
+//   added at the end of the file, so later pages have larger IDs)
+
+static int cmpLoc(const void *a, const void *b)
+{
+	const IndexLoc *x = a, *y = b;
+	if (x->bucket != y->bucket) return (x->bucket < y->bucket) ? -1 : 1;
+	Count px = x->page + 1, py = y->page + 1;  // NO_PAGE comes first
+	if (px != py) return (px < py) ? -1 : 1;
+	return (x->slot < y->slot) ? -1 : (x->slot > y->slot);
+}
+
+// room for k more locations after the n in *locs (of *size)
+
+static IndexLoc *moreLocs(IndexLoc **locs, Count n, Count k, Count *size)
+{
+	if (n + k > *size) {
+		while (n + k > *size) *size *= 2;
+		*locs = realloc(*locs, *size * sizeof(IndexLoc));
+		assert(*locs != NULL);
+	}
+	return *locs + n;
+}
+
+// is entry e for the same attribute as probe, with probe's value as a prefix?
+
+static Bool hasPrefix(Entry *e, Entry *probe)
+{
+	return e->attr == probe->attr && e->len >= probe->len
+	    && memcmp(e->val, probe->val, probe->len) == 0;
+}
+
+// readers: collect the locations of saved entries matching probe
+//   (exactly, or as a prefix) into *locs (of *size); returns how many
+// the last fence at or before probe starts the only run of entries
+//   that can match
+
+static Count searchFile(HashIndex x, Entry *probe, Bool prefix, IndexLoc **locs, Count *size)
+{
+	if (x->nfences == 0) return 0;
+	int lo = 0, hi = x->nfences - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (cmpEntry(&x->fences[mid].key, probe) <= 0)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	Count n = 0;
+	fseek(x->file, x->fences[lo].off, SEEK_SET);
+	while (ftell(x->file) < x->fenceoff) {
+		Entry e;
+		char val[MAXTUPLEN];
+		if (!readEntryHead(x, &e, val)) break;
+		int cmp = cmpEntry(&e, probe);
+		Bool match = prefix ? hasPrefix(&e, probe) : (cmp == 0);
+		if (!match) {
+			if (cmp > 0) break;  // past the value or prefix
+			fseek(x->file, e.nlocs * sizeof(IndexLoc), SEEK_CUR);
+			continue;
+		}
+		IndexLoc *into = moreLocs(locs, n, e.nlocs, size);
+		if (fread(into, sizeof(IndexLoc), e.nlocs, x->file) != e.nlocs) break;
+		n += e.nlocs;
+		if (!prefix) break;
+	}
+	return n;
+}
+
+// collect the locations of attr = val (len bytes), or (if prefix) of
+//   the attr values starting with val, into a malloc'd array *locs
+// returns the number of locations, not in any particular order
+// caller must hold the lock
+
+static Count collect(HashIndex x, Count attr, char *val, Count len, Bool prefix, IndexLoc **locs)
+{
+	Count n = 0, size = 16;
+	*locs = malloc(size * sizeof(IndexLoc));
+	assert(*locs != NULL);
+	// values with the prefix follow the prefix itself in order
+	Entry probe = { .attr = attr, .len = len, .val = val };
+	if (!x->writer)
+		n = searchFile(x, &probe, prefix, locs, &size);
+	else if (!prefix) {
+		Entry *e = findEntry(x, attr, val, len, FALSE);
+		if (e != NULL) {
+			memcpy(moreLocs(locs, n, e->nlocs, &size), e->locs, e->nlocs * sizeof(IndexLoc));
+			n = e->nlocs;
+		}
+	}
+	else {
+		BTCursor c;
+		btSeek(x->tree, &probe, &c);
+		Entry *e;
+		while ((e = btNext(&c)) != NULL && hasPrefix(e, &probe)) {
+			memcpy(moreLocs(locs, n, e->nlocs, &size), e->locs, e->nlocs * sizeof(IndexLoc));
+			n += e->nlocs;
+		}
+	}
+	return n;
+}
+
+// where the tuples whose attribute attr is val (len bytes) are, or
+//   (if prefix) those where it starts with val; prefix lookups need
+//   an ordered index
+// *locs is set to a malloc'd array, in scan order, of the locations
+// returns the number of locations
+
+Count hindexLookup(HashIndex x, Count attr, char *val, Count len, Bool prefix, IndexLoc **locs)
+{
+	pthread_mutex_lock(&x->lock);
+	Count n = collect(x, attr, val, len, prefix, locs);
+	pthread_mutex_unlock(&x->lock);
+	qsort(*locs, n, sizeof(IndexLoc), cmpLoc);
+	return n;
+}
+
+// locations of the tuples whose attribute attr could match pattern,
+//   from attr's trigram index: those holding every trigram in the
+//   literal parts of pattern (between '%'s)
+// *locs is set to a malloc'd array of *n locations, in scan order
+// FALSE if the pattern has no trigrams (so every tuple could match)
+
+Bool hindexLookupTrigrams(HashIndex x, Count attr, char *pattern, IndexLoc **locs, Count *n)
+{
+	Bool any = FALSE;
+	*locs = NULL;
+	*n = 0;
+	pthread_mutex_lock(&x->lock);
+	Count plen = strlen(pattern);
+	for (Count i = 0; i + GRAMLEN <= plen; i++) {
+		if (memchr(pattern+i, '%', GRAMLEN) != NULL || !firstGram(pattern, i)) continue;
+		IndexLoc *more;
+		Count m = collect(x, attr+GRAMKEY, pattern+i, GRAMLEN, FALSE, &more);
+		qsort(more, m, sizeof(IndexLoc), cmpLoc);
+		if (!any) {
+			*locs = more;
+			*n = m;
+			any = TRUE;
+			continue;
+		}
+		// keep the locations in both lists (both in scan order)
+		Count k = 0, j = 0;
+		for (Count l = 0; l < *n && j < m; ) {
+			int cmp = cmpLoc(&(*locs)[l], &more[j]);
+			if (cmp == 0) { (*locs)[k++] = (*locs)[l]; l++; j++; }
+			else if (cmp < 0) l++;
+			else j++;
+		}
+		*n = k;
+		free(more);
+		if (k == 0) break;
+	}
+	pthread_mutex_unlock(&x->lock);
+	return any;
+}
@@ -0,0 +1,32 @@
+// hashidx.h ... interface to secondary hash indexes
+// part of Multi-attribute Linear-hashed Files
+// See hashidx.c for details of HashIndex type and functions
+
+#ifndef HASHIDX_H
+#define HASHIDX_H 1
+
+typedef struct HashIndexRep *HashIndex;
+
+#include "defs.h"
+
+// where a tuple is: slot'th tuple in a page of bucket's chain
+typedef struct {
+	PageID bucket;  // bucket (primary data page)
+	PageID page;    // overflow page, or NO_PAGE for the data page
+	Count  slot;    // position of tuple in page
+} IndexLoc;
+
+#include "tuple.h"
+
+HashIndex hindexOpen(char *name, Count nattrs, Count attrs, Count ordered, Count grams, Bool writer, Bool *stale);
+void hindexClose(HashIndex x);
+void hindexClear(HashIndex x);
+void hindexAddTuple(HashIndex x, IndexLoc loc, Tuple t);
+void hindexRemoveTuples(HashIndex x, PageID bucket, Tuple *ts, Count n);
+Bool hindexHas(HashIndex x, Count attr);
+Bool hindexOrdered(HashIndex x, Count attr);
+Bool hindexTrigrams(HashIndex x, Count attr);
+Count hindexLookup(HashIndex x, Count attr, char *val, Count len, Bool prefix, IndexLoc **locs);
+Bool hindexLookupTrigrams(HashIndex x, Count attr, char *pattern, IndexLoc **locs, Count *n);
+
+#endif
@@ -0,0 +1,335 @@
+// hashjoin.c ... equi-joins between two relations
+// part of Multi-attribute Linear-hashed Files
+// Join two relations on one attribute of each, using their buckets
+
+#include "defs.h"
+#include "hashjoin.h"
+#include "page.h"
+#include "tuple.h"
+#include "hash.h"
+
+// A tuple's bucket is given by the low bits of its hash, and the
+// choice vector says which attribute each hash bit comes from. If the
+// first bits of both choice vectors are the same bits of the join
+// attributes' hashes, tuples with equal join values agree on those
+// bits, so they can only be in buckets whose numbers agree on them
+// too. Each relation's buckets then fall into 2^bits classes (bucket
+// number mod 2^bits), and a class of one relation only needs to be
+// joined with the same class of the other: the smaller relation's
+// buckets in the class go into an in-memory hash table, and the other
+// relation's buckets in the class are read and probed against it.
+// Nothing is repartitioned, and each page is read once.
+// Usable bits are limited by both relations' depths (d-1 for files
+// with partial expansions, whose bucket numbers keep only the group).
+// Otherwise, or if a class would hold more than JOINMEM pages, the
+// join is a grace hash join: both relations are split on the join
+// value's hash into nparts spill files each, and then each pair of
+// partitions is joined in memory. With one partition, nothing is
+// spilled, and this is just the aligned join with no shared bits.
+// Results are the tuple from the first relation followed by the one
+// from the second, as text.
+
+#define JOINMEM  2048  // pages of the build side held in memory at once
+#define MAXPARTS 256   // most spill files per relation
+
+typedef struct {
+	Tuple *tuples;
+	Count  n, size;
+} TupleList;
+
+typedef struct Entry {
+	Bits   hash;   // of the join value
+	char  *val;    // join value, within tuple
+	Count  len;
+	Tuple  tuple;
+	struct Entry *next;
+} Entry;
+
+typedef struct {
+	Entry **table;
+	Entry  *entries;
+	Count   logsize;  // table has 2^logsize slots
+} JoinTable;
+
+typedef struct {
+	Reln    r, s;       // relations, in result order
+	Count   rattr, sattr;
+	Bool    buildR;     // r is held in memory
+	Output  out;
+} Join;
+
+// pages in relation, including overflow pages in chains
+
+static Count relPages(Reln r)
+{
+	return npages(r) + novflow(r);
+}
+
+// bits of the hash that a bucket number is sure to agree with
+
+static Count addressBits(Reln r)
+{
+	if (flags(r) & RELN_PARTIAL) return depth(r) - 1;
+	return depth(r);
+}
+
+// join value (attribute attr) of tuple t; sets *len to its length
+
+static char *joinValue(Tuple t, Count attr, Count *len)
+{
+	char *c = t;
+	for (Count a = 0; a < attr; a++) c = strchr(c, ',') + 1;
+	char *end = strchr(c, ',');
+	*len = (end == NULL) ? strlen(c) : end - c;
+	return c;
+}
+
+static void addTuple(TupleList *l, char *t, Count len)
+{
+	if (l->n == l->size) {
+		l->size = (l->size == 0) ? 64 : 2*l->size;
+		l->tuples = realloc(l->tuples, l->size * sizeof(Tuple));
+		assert(l->tuples != NULL);
+	}
+	Tuple copy = malloc(len + 1);
+	assert(copy != NULL);
+	memcpy(copy, t, len);
+	copy[len] = '\0';
+	l->tuples[l->n++] = copy;
+}
+
+static void freeList(TupleList *l)
+{
+	for (Count i = 0; i < l->n; i++) free(l->tuples[i]);
+	free(l->tuples);
+	l->tuples = NULL;
+	l->n = l->size = 0;
+}
+
+// append copies of all tuples in bucket b and its overflow chain
+
+static void readChain(Reln r, PageID b, TupleList *l)
+{
+	FILE *f = dataFile(r);
+	PageID pid = b;
+	while (pid != NO_PAGE) {
+		Page p = getPage(f, pid);
+		char *c = pageData(p);
+		for (Count i = 0; i < pageNTuples(p); i++) {
+			Count len = strlen(c);
+			addTuple(l, c, len);
+			c += len + 1;
+		}
+		pid = pageOvflow(p);
+		free(p);
+		f = ovflowFile(r);
+	}
+}
+
+// slot for hash h; multiplying mixes in every bit, as the buckets
+//   (or partition) being joined may all share some of the low ones
+
+static Count slotOf(JoinTable *jt, Bits h)
+{
+	return ((unsigned long long)h * 0x9e3779b97f4a7c15ULL) >> (64 - jt->logsize);
+}
+
+// hash table on attribute attr of the tuples in l (which it points into)
+
+static void buildTable(JoinTable *jt, TupleList *l, Count attr)
+{
+	jt->logsize = 1;
+	while ((1u << jt->logsize) < l->n) jt->logsize++;
+	jt->table = calloc(1u << jt->logsize, sizeof(Entry *));
+	jt->entries = malloc((l->n + 1) * sizeof(Entry));
+	assert(jt->table != NULL && jt->entries != NULL);
+	for (Count i = 0; i < l->n; i++) {
+		Entry *e = &jt->entries[i];
+		e->tuple = l->tuples[i];
+		e->val = joinValue(e->tuple, attr, &e->len);
+		e->hash = hash_any((unsigned char *)e->val, e->len);
+		Count slot = slotOf(jt, e->hash);
+		e->next = jt->table[slot];
+		jt->table[slot] = e;
+	}
+}
+
+static void freeTable(JoinTable *jt)
+{
+	free(jt->table);
+	free(jt->entries);
+}
+
+// write tuple u (from relation r) as text into buf; returns its length
+
+static Count textOf(Reln r, Tuple u, char *buf)
+{
+	Count len = strlen(u);
+	if (types(r) != 0) return tupleText(r, u, len, buf);
+	memcpy(buf, u, len);
+	return len;
+}
+
+// write the result for a matching build tuple b and probe tuple p
+
+static void putJoined(Join *j, Tuple b, Tuple p)
+{
+	char buf[2*MAXTEXTLEN+2];
+	Tuple rt = j->buildR ? b : p, st = j->buildR ? p : b;
+	Count len = textOf(j->r, rt, buf);
+	buf[len++] = ',';
+	len += textOf(j->s, st, buf + len);
+	putTuple(j->out, buf, len);
+}
+
+// write the results for probe tuple t
+
+static void probeTable(Join *j, JoinTable *jt, Tuple t, Count attr)
+{
+	Count len;
+	char *val = joinValue(t, attr, &len);
+	Bits h = hash_any((unsigned char *)val, len);
+	for (Entry *e = jt->table[slotOf(jt, h)]; e != NULL; e = e->next) {
+		if (e->hash == h && e->len == len && memcmp(e->val, val, len) == 0)
+			putJoined(j, e->tuple, t);
+	}
+}
+
+// join the buckets of each class (bucket# mod 2^bits) with the
+//   buckets of the same class in the other relation
+
+static void alignedJoin(Join *j, Count bits)
+{
+	Reln build = j->buildR ? j->r : j->s, probe = j->buildR ? j->s : j->r;
+	Count battr = j->buildR ? j->rattr : j->sattr;
+	Count pattr = j->buildR ? j->sattr : j->rattr;
+	Count nclasses = 1u << bits;
+	for (Count c = 0; c < nclasses; c++) {
+		TupleList bl = { NULL, 0, 0 }, pl = { NULL, 0, 0 };
+		for (PageID b = c; b < npages(build); b += nclasses)
+			readChain(build, b, &bl);
+		if (bl.n == 0) continue;
+		JoinTable jt;
+		buildTable(&jt, &bl, battr);
+		for (PageID b = c; b < npages(probe); b += nclasses) {
+			readChain(probe, b, &pl);
+			for (Count i = 0; i < pl.n; i++)
+				probeTable(j, &jt, pl.tuples[i], pattr);
+			freeList(&pl);
+		}
+		freeTable(&jt);
+		freeList(&bl);
+	}
+}
+
+// split relation r into nparts spill files on the hash of attribute
+//   attr; the top bits are used, which the join tables barely depend on
+// tuples are written '\0'-terminated
+
+static Status partition(Reln r, Count attr, FILE **parts, Count nparts)
+{
+	for (Count i = 0; i < nparts; i++) {
+		if ((parts[i] = tmpfile()) == NULL) {
+			while (i > 0) fclose(parts[--i]);
+			return ~OK;
+		}
+	}
+	TupleList l = { NULL, 0, 0 };
+	for (PageID b = 0; b < npages(r); b++) {
+		readChain(r, b, &l);
+		for (Count i = 0; i < l.n; i++) {
+			Count len;
+			char *val = joinValue(l.tuples[i], attr, &len);
+			Bits h = hash_any((unsigned char *)val, len);
+			FILE *f = parts[(h >> 24) & (nparts-1)];
+			fwrite(l.tuples[i], 1, strlen(l.tuples[i]) + 1, f);
+		}
+		freeList(&l);
+	}
+	for (Count i = 0; i < nparts; i++) rewind(parts[i]);
+	return OK;
+}
+
+// partition both relations, then join each pair of partitions
+
+static Status graceJoin(Join *j, Count nparts, char *err)
+{
+	Reln build = j->buildR ? j->r : j->s, probe = j->buildR ? j->s : j->r;
+	Count battr = j->buildR ? j->rattr : j->sattr;
+	Count pattr = j->buildR ? j->sattr : j->rattr;
+	FILE *bparts[nparts], *pparts[nparts];
+	if (partition(build, battr, bparts, nparts) != OK) {
+		sprintf(err, "Can't create spill files");
+		return ~OK;
+	}
+	if (partition(probe, pattr, pparts, nparts) != OK) {
+		for (Count i = 0; i < nparts; i++) fclose(bparts[i]);
+		sprintf(err, "Can't create spill files");
+		return ~OK;
+	}
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	for (Count i = 0; i < nparts; i++) {
+		TupleList bl = { NULL, 0, 0 };
+		while ((len = getdelim(&line, &size, '\0', bparts[i])) > 0)
+			addTuple(&bl, line, len - 1);
+		fclose(bparts[i]);
+		if (bl.n > 0) {
+			JoinTable jt;
+			buildTable(&jt, &bl, battr);
+			while (getdelim(&line, &size, '\0', pparts[i]) > 0)
+				probeTable(j, &jt, line, pattr);
+			freeTable(&jt);
+		}
+		fclose(pparts[i]);
+		freeList(&bl);
+	}
+	free(line);
+	return OK;
+}
+
+// decide how to join r on attribute rattr with s on sattr (0-based)
+// the relation with fewer pages is the one held in memory
+
+Status planJoin(Reln r, Count rattr, Reln s, Count sattr, JoinPlan *plan, char *err)
+{
+	if (rattr >= nattrs(r) || sattr >= nattrs(s)) {
+		sprintf(err, "Invalid join attribute");
+		return ~OK;
+	}
+	if (attrType(r, rattr) != attrType(s, sattr)) {
+		sprintf(err, "Join attributes have different types");
+		return ~OK;
+	}
+	ChVecItem *rcv = chvec(r), *scv = chvec(s);
+	Count bits = 0;
+	while (bits < MAXCHVEC && rcv[bits].att == rattr && scv[bits].att == sattr
+	       && rcv[bits].bit == scv[bits].bit)
+		bits++;
+	if (bits > addressBits(r)) bits = addressBits(r);
+	if (bits > addressBits(s)) bits = addressBits(s);
+
+	Count rpages = relPages(r), spages = relPages(s);
+	plan->buildR = (rpages <= spages);
+	Count build = plan->buildR ? rpages : spages;
+	plan->aligned = bits > 0 && (build >> bits) <= JOINMEM;
+	plan->bits = plan->aligned ? bits : 0;
+	plan->nparts = 1;
+	if (!plan->aligned) {
+		while (plan->nparts < MAXPARTS && build / plan->nparts > JOINMEM)
+			plan->nparts *= 2;
+	}
+	return OK;
+}
+
+// write the join of r and s (as planned) to out
+
+Status execJoin(Reln r, Count rattr, Reln s, Count sattr, JoinPlan *plan, Output out, char *err)
+{
+	Join j = { r, s, rattr, sattr, plan->buildR, out };
+	if (plan->nparts > 1)
+		return graceJoin(&j, plan->nparts, err);
+	alignedJoin(&j, plan->bits);
+	return OK;
+}
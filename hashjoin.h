@@ -0,0 +1,23 @@
+// hashjoin.h ... interface to equi-joins between relations
+// part of Multi-attribute Linear-hashed Files
+// See hashjoin.c for details of JoinPlan type and functions
+
+#ifndef HASHJOIN_H
+#define HASHJOIN_H 1
+
+#include "defs.h"
+#include "reln.h"
+#include "output.h"
+
+// how a join is done (see hashjoin.c)
+typedef struct {
+	Bool  aligned;  // bucket against matching buckets, no repartitioning
+	Count bits;     // address bits shared by matching buckets (aligned)
+	Count nparts;   // partitions of a grace hash join (not aligned)
+	Bool  buildR;   // the first relation is held in memory
+} JoinPlan;
+
+Status planJoin(Reln r, Count rattr, Reln s, Count sattr, JoinPlan *plan, char *err);
+Status execJoin(Reln r, Count rattr, Reln s, Count sattr, JoinPlan *plan, Output out, char *err);
+
+#endif
@@ -1,34 +1,98 @@
 // insert.c ... add tuples to a relation
 // part of Multi-attribute linear-hashed files
 // Reads tuples from stdin and inserts into Reln
-// Usage:  ./insert  [-v]  RelName
+// Usage:  ./insert  [-v]  [-t #threads]  RelName
 // Last modified by John Shepherd, July 2019
 
+#include <pthread.h>
 #include "defs.h"
 #include "reln.h"
 #include "tuple.h"
 
-#define USAGE "./insert  [-v]  RelName"
+#define USAGE "./insert  [-v]  [-t #threads]  RelName"
+#define BATCHSIZE 1024
+#define MAXTHREADS 64
+
+// state shared by all inserter threads
+
+typedef struct {
+	Reln  r;       // relation being loaded
+	FILE *in;      // source of tuples
+	int   verbose; // show where each tuple went
+	Count lineno;  // lines read from in so far
+	pthread_mutex_t inLatch;  // serialises reads from in
+} Loader;
+
+// read batches of tuples and insert them until input runs out
+// tuples are buffered and inserted a batch at a time,
+// so each bucket's page chain is traversed once per batch
+// an invalid line in the input stops the load, with its line number
+
+static void *loadTuples(void *arg)
+{
+	Loader *ld = arg;
+	Tuple t;  // tuple buffer
+	char err[MAXERRMSG+MAXTEXTLEN];  // buffer for error messages
+	char tup[MAXTEXTLEN];  // buffer for printable tuples
+	Tuple batch[BATCHSIZE];
+	PageID pids[BATCHSIZE];
+	Count n;
+	do {
+		n = 0;
+		pthread_mutex_lock(&ld->inLatch);
+		while (n < BATCHSIZE) {
+			ld->lineno++;
+			if (readTuple(ld->r,ld->in,&t,tup) != OK) {
+				sprintf(err, "Invalid tuple on line %d: %s", ld->lineno, tup);
+				fatal(err);
+			}
+			if (t == NULL) break;
+			batch[n++] = t;
+		}
+		pthread_mutex_unlock(&ld->inLatch);
+		if (n == 0) break;
+		addBatchToRelation(ld->r, batch, n, pids);
+		for (Count i = 0; i < n; i++) {
+			tupleString(ld->r,batch[i],tup); // printable version
+			if (pids[i] == NO_PAGE) {
+				sprintf(err, "Insert of %s failed\n", tup);
+				fatal(err);
+			}
+			if (ld->verbose) printf("%s -> %d\n",tup,pids[i]);
+			free(batch[i]);
+		}
+	} while (n == BATCHSIZE);
+	return NULL;
+}
 
 // Main ... process args, read/insert tuples
 
 int main(int argc, char **argv)
 {
 	Reln r;  // handle on the open relation
-	Tuple t;  // tuple buffer
 	char err[2*MAXERRMSG];  // buffer for error messages
-	char tup[MAXTUPLEN];  // buffer for printable tuples
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	int nthreads = 1;  // number of inserter threads
 	char *rname;  // name of table/file
+	int arg = 1;
 
 	// process command-line args
 
-	if (argc < 2) fatal(USAGE);
-    if (strcmp(argv[1], "-v") == 0)
-		{ verbose = 1; rname = argv[2]; }
-	else
-		{ verbose = 0; rname = argv[1]; }
-
+	while (arg < argc && argv[arg][0] == '-') {
+		if (strcmp(argv[arg], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[arg], "-t") == 0 && arg+1 < argc)
+			nthreads = atoi(argv[++arg]);
+		else
+			fatal(USAGE);
+		arg++;
+	}
+	if (arg >= argc) fatal(USAGE);
+	if (nthreads < 1 || nthreads > MAXTHREADS) {
+		sprintf(err, "Invalid #threads: %d (must be 0 < # <= %d)", nthreads, MAXTHREADS);
+		fatal(err);
+	}
+	rname = argv[arg++];
 
 	// set up relation for writing
 
@@ -37,33 +101,33 @@ int main(int argc, char **argv)
 		fatal(err);
 	}
 	if ((r = openRelation(rname,"r+")) == NULL) {
-		sprintf(err, "Can't open relation: %s",argv[1]);
+		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
 
 	// read stdin and insert tuples
     // 手动debug调试
     FILE *file = stdin;
-    if (argc == 4) {
-        file = fopen(argv[3], "r");
+    if (arg < argc) {
+        file = fopen(argv[arg], "r");
         assert(file != NULL);
     }
 
-	while ((t = readTuple(r,file)) != NULL) {
-		PageID pid;
-		pid = addToRelation(r,t);
-
-		tupleString(t,tup); // printable version
-		if (pid == NO_PAGE) {
-			sprintf(err, "Insert of %s failed\n", tup);
-			fatal(err);
-		}
-		if (verbose) printf("%s -> %d\n",tup,pid);
-		free(t);
+	Loader ld = { r, file, verbose, 0 };
+	pthread_mutex_init(&ld.inLatch, NULL);
+	if (nthreads == 1)
+		loadTuples(&ld);
+	else {
+		pthread_t tids[MAXTHREADS];
+		for (int i = 0; i < nthreads; i++)
+			pthread_create(&tids[i], NULL, loadTuples, &ld);
+		for (int i = 0; i < nthreads; i++)
+			pthread_join(tids[i], NULL);
 	}
+	pthread_mutex_destroy(&ld.inLatch);
 
 	// clean up
-    if (argc == 4) {
+    if (file != stdin) {
         fclose(file);
     }
 
@@ -71,4 +135,3 @@ int main(int argc, char **argv)
 
 	return 0;
 }
-
@@ -0,0 +1,92 @@
+// join.c ... join two relations
+// part of Multi-attribute linear-hashed files
+// Equi-join two named relations on one attribute of each
+// Usage:  ./join  [-v]  [-f format]  [-d fd]  RelName1  a1  RelName2  a2
+// - a1 and a2 are attribute numbers, from 1
+// - each result is the tuple from RelName1, then the one from RelName2
+// - -v shows on stderr how the join is done (see hashjoin.c)
+// - -f chooses the output format: text (default), length or binary
+//   (see output.c)
+// - -d writes the results to file descriptor #fd instead of stdout
+
+#include "defs.h"
+#include "reln.h"
+#include "hashjoin.h"
+#include "output.h"
+
+#define USAGE "./join  [-v]  [-f format]  [-d fd]  RelName1  a1  RelName2  a2"
+
+// open relation rname, or give up
+
+static Reln openOrDie(char *rname)
+{
+	char err[MAXERRMSG];
+	Reln r;
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s",rname);
+		fatal(err);
+	}
+	if ((r = openRelation(rname,"r")) == NULL) {
+		sprintf(err, "Can't open relation: %s",rname);
+		fatal(err);
+	}
+	return r;
+}
+
+// Main ... process args, run join
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];  // buffer for error messages
+	int verbose = 0;  // show how the join is done
+	int format = OUT_TEXT;  // output format
+	int fd = 1;  // where results go
+
+	// process command-line args
+
+	int arg = 1;
+	while (arg < argc && argv[arg][0] == '-') {
+		if (strcmp(argv[arg], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[arg], "-f") == 0 && arg+1 < argc) {
+			if ((format = outputFormat(argv[++arg])) < 0) fatal(USAGE);
+		}
+		else if (strcmp(argv[arg], "-d") == 0 && arg+1 < argc)
+			fd = atoi(argv[++arg]);
+		else
+			fatal(USAGE);
+		arg++;
+	}
+	if (argc - arg != 4) fatal(USAGE);
+	int rattr = atoi(argv[arg+1]), sattr = atoi(argv[arg+3]);
+	if (rattr < 1 || sattr < 1) fatal(USAGE);
+
+	Reln r = openOrDie(argv[arg]);
+	Reln s = openOrDie(argv[arg+2]);
+
+	// choose and run the join
+
+	JoinPlan plan;
+	if (planJoin(r, rattr-1, s, sattr-1, &plan, err) != OK)
+		fatal(err);
+	// on stderr, so it can't get mixed into the results
+	if (verbose) {
+		if (plan.aligned)
+			fprintf(stderr, "Bucket-aligned join: %d bucket classes, %s in memory\n",
+			        1 << plan.bits, argv[plan.buildR ? arg : arg+2]);
+		else
+			fprintf(stderr, "Grace hash join: %d partitions, %s in memory\n",
+			        plan.nparts, argv[plan.buildR ? arg : arg+2]);
+	}
+	Output out = openOutput(fd, format);
+	if (execJoin(r, rattr-1, s, sattr-1, &plan, out, err) != OK)
+		fatal(err);
+	if (closeOutput(out) != OK)
+		fatal("Can't write results");
+
+	// clean up
+	closeRelation(r);
+	closeRelation(s);
+
+	return 0;
+}
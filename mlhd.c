@@ -0,0 +1,248 @@
+// mlhd.c ... resident query server
+// part of Multi-attribute linear-hashed files
+// Keeps relations open and answers queries over a Unix domain socket
+// Usage:  ./mlhd  [-v]  [-s socket]  [-t #threads]  [-c #MB]
+// where socket = path of the socket to listen on (default mlhd.sock)
+//	   #threads = threads used to scan the buckets of each query
+//	   #MB = size of the query result cache (default 16, 0 for none)
+//
+// Protocol: a client sends queries, one per line, in the same form
+//   as the arguments of ./query:   'a1,a3,..' from RelName where 'v1,v2,...'
+// For each query the server sends back the result tuples, each as a
+//   4-byte length (most significant byte first) and its bytes, then
+//   the length MLHD_END, then a status line: "OK" or "ERR message".
+//   (Projected rows can be empty, so they can't be ended by lines.)
+// A connection may carry any number of queries.
+
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "defs.h"
+#include "reln.h"
+#include "exec.h"
+
+#define USAGE "./mlhd  [-v]  [-s socket]  [-t #threads]  [-c #MB]"
+#define CACHEMB 16  // default result cache size
+
+// an open relation
+// queries share the relation (lock held shared), and check under it
+//   whether writers have changed it; only bringing it up to date
+//   needs it exclusively
+
+typedef struct OpenReln {
+	char  name[MAXRELNAME+1];
+	Reln  r;
+	pthread_rwlock_t lock;
+	struct OpenReln *next;
+} OpenReln;
+
+static OpenReln *relns = NULL;  // relations opened so far
+static pthread_mutex_t relnsLatch = PTHREAD_MUTEX_INITIALIZER;
+static int verbose = 0;  // log queries on stderr
+static int nthreads = 1;  // scan threads per query
+static QueryCache cache = NULL;  // results of recent queries
+static volatile sig_atomic_t stopping = 0;  // shut down requested
+
+// find an open relation, opening it on first use
+// returns NULL if there is no such relation
+
+static OpenReln *findRelation(char *name)
+{
+	pthread_mutex_lock(&relnsLatch);
+	OpenReln *o;
+	for (o = relns; o != NULL; o = o->next) {
+		if (strcmp(o->name, name) == 0) break;
+	}
+	if (o == NULL && strlen(name) <= MAXRELNAME && existsRelation(name)) {
+		Reln r = openRelation(name, "r");
+		if (r != NULL) {
+			o = malloc(sizeof(OpenReln));
+			assert(o != NULL);
+			strcpy(o->name, name);
+			o->r = r;
+			pthread_rwlock_init(&o->lock, NULL);
+			o->next = relns;
+			relns = o;
+		}
+	}
+	pthread_mutex_unlock(&relnsLatch);
+	return o;
+}
+
+// run one query line, writing the response to out
+
+static void serveQuery(char *line, FILE *out)
+{
+	char err[MAXERRMSG];  // buffer for error messages
+	char *attrs, *rname, *vals;
+	OpenReln *o;
+	Status ok = ~OK;
+
+	if (verbose) fprintf(stderr, "mlhd: %s\n", line);
+	if (parseQuery(line, &attrs, &rname, &vals) != OK)
+		snprintf(err, MAXERRMSG, "Usage: 'a1,a3,..' from RelName where 'v1,v2,...'");
+	else if ((o = findRelation(rname)) == NULL)
+		snprintf(err, MAXERRMSG, "No such relation: %s", rname);
+	else {
+		pthread_rwlock_rdlock(&o->lock);
+		if (relationChanged(o->r)) {
+			pthread_rwlock_unlock(&o->lock);
+			pthread_rwlock_wrlock(&o->lock);
+			refreshRelation(o->r);
+			pthread_rwlock_unlock(&o->lock);
+			pthread_rwlock_rdlock(&o->lock);
+		}
+		Output res = openOutputFile(out, OUT_LENGTH);
+		if (cache != NULL)
+			ok = execCachedQuery(cache, o->r, rname, attrs, vals, nthreads, res, err);
+		else
+			ok = execQuery(o->r, attrs, vals, nthreads, TRUE, res, err);
+		closeOutput(res);
+		pthread_rwlock_unlock(&o->lock);
+	}
+	for (int i = 0; i < 4; i++) putc((MLHD_END >> (24 - 8*i)) & 0xff, out);
+	if (ok == OK)
+		fprintf(out, "OK\n");
+	else
+		fprintf(out, "ERR %s\n", err);
+	fflush(out);
+}
+
+// handle all queries from one client
+
+static void *serveClient(void *arg)
+{
+	int fd = *(int *)arg;
+	free(arg);
+	// out of descriptors or memory: drop the client, not the server
+	int fd2 = dup(fd);
+	FILE *in = fdopen(fd, "r");
+	FILE *out = (fd2 < 0) ? NULL : fdopen(fd2, "w");
+	if (in == NULL || out == NULL) {
+		fprintf(stderr, "mlhd: can't serve client: %s\n", strerror(errno));
+		if (in != NULL) fclose(in); else close(fd);
+		if (out != NULL) fclose(out); else if (fd2 >= 0) close(fd2);
+		return NULL;
+	}
+	char line[MAXQUERYLEN];
+	while (fgets(line, MAXQUERYLEN, in) != NULL) {
+		Count n = strlen(line);
+		if (n > 0 && line[n-1] == '\n') line[--n] = '\0';
+		if (n == 0) continue;
+		serveQuery(line, out);
+		if (ferror(out)) break;
+	}
+	fclose(in);
+	fclose(out);
+	return NULL;
+}
+
+static void stop(int sig)
+{
+	stopping = 1;
+}
+
+// Main ... process args, accept connections until interrupted
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];  // buffer for error messages
+	char *path = MLHD_SOCKET;  // socket to listen on
+	int cachemb = CACHEMB;  // result cache size
+	int arg = 1;
+
+	// process command-line args
+
+	while (arg < argc && argv[arg][0] == '-') {
+		if (strcmp(argv[arg], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[arg], "-s") == 0 && arg+1 < argc)
+			path = argv[++arg];
+		else if (strcmp(argv[arg], "-t") == 0 && arg+1 < argc)
+			nthreads = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-c") == 0 && arg+1 < argc)
+			cachemb = atoi(argv[++arg]);
+		else
+			fatal(USAGE);
+		arg++;
+	}
+	if (arg != argc) fatal(USAGE);
+	if (nthreads < 1) {
+		sprintf(err, "Invalid #threads: %d (must be > 0)", nthreads);
+		fatal(err);
+	}
+	if (cachemb < 0 || cachemb > 4000) {
+		sprintf(err, "Invalid cache size: %d (must be 0..4000)", cachemb);
+		fatal(err);
+	}
+	if (cachemb > 0) cache = newQueryCache((Count)cachemb << 20);
+
+	// set up the socket
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) fatal("Socket path too long");
+	strcpy(addr.sun_path, path);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) fatal("Can't create socket");
+	unlink(path);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0
+	    || listen(sock, 64) != 0) {
+		snprintf(err, MAXERRMSG, "Can't listen on %s", path);
+		fatal(err);
+	}
+
+	// clients that go away mustn't kill the server;
+	// SIGINT/SIGTERM interrupt accept() and shut down cleanly
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (verbose) fprintf(stderr, "mlhd: listening on %s\n", path);
+
+	// one thread per connection
+
+	while (!stopping) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			// only a bad listening socket is hopeless
+			if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK
+			    || errno == EOPNOTSUPP || errno == EFAULT)
+				fatal("accept failed");
+			// e.g. out of descriptors (EMFILE, ENFILE) or a client that
+			//   gave up (ECONNABORTED): log it, and pause before retrying
+			//   in case it is a shortage that takes a while to clear
+			fprintf(stderr, "mlhd: accept: %s\n", strerror(errno));
+			struct timespec pause = { 0, 100000000 };
+			nanosleep(&pause, NULL);
+			continue;
+		}
+		int *arg = malloc(sizeof(int));
+		assert(arg != NULL);
+		*arg = fd;
+		pthread_t tid;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&tid, &attr, serveClient, arg) != 0) {
+			close(fd);
+			free(arg);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	// clean up
+	close(sock);
+	unlink(path);
+	if (cache != NULL) freeQueryCache(cache);
+	if (verbose) fprintf(stderr, "mlhd: stopped\n");
+	return 0;
+}
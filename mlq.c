@@ -0,0 +1,113 @@
+// mlq.c ... send queries to the query server
+// part of Multi-attribute linear-hashed files
+// Thin client for mlhd; takes the same query as ./query
+// Usage:  ./mlq  [-s socket]  [a1,a3,..  from  RelName  where  v1,v2,...]
+// With no query, reads queries (one per line) from stdin and sends
+//   them all over one connection
+// Exit status is 1 if any query failed
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "defs.h"
+#include "exec.h"
+
+#define USAGE "./mlq  [-s socket]  [a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,...]"
+
+// next 4-byte length from the server
+
+static Count getLength(FILE *from)
+{
+	Byte b[4];
+	if (fread(b, 1, 4, from) != 4)
+		fatal("Lost connection to server");
+	return (Count)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+// send one query and copy its results to stdout, one per line
+// returns OK if the server ran the query
+
+static Status ask(FILE *to, FILE *from, char *query)
+{
+	char line[MAXQUERYLEN];
+	fprintf(to, "%s\n", query);
+	fflush(to);
+	// length-prefixed results, up to the end marker
+	Count len;
+	while ((len = getLength(from)) != MLHD_END) {
+		while (len > 0) {
+			Count n = (len < MAXQUERYLEN) ? len : MAXQUERYLEN;
+			if (fread(line, 1, n, from) != n)
+				fatal("Lost connection to server");
+			fwrite(line, 1, n, stdout);
+			len -= n;
+		}
+		putchar('\n');
+	}
+	// status line
+	if (fgets(line, MAXQUERYLEN, from) == NULL)
+		fatal("Lost connection to server");
+	if (strcmp(line, "OK\n") == 0) return OK;
+	fputs(strncmp(line, "ERR ", 4) == 0 ? line+4 : line, stderr);
+	return ~OK;
+}
+
+// Main ... process args, connect, run queries
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];  // buffer for error messages
+	char query[MAXQUERYLEN];  // query line sent to server
+	char *path = MLHD_SOCKET;  // server's socket
+	Status status = OK;
+	int arg = 1;
+
+	// process command-line args
+
+	while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+		if (strcmp(argv[arg], "-s") == 0 && arg+1 < argc)
+			path = argv[++arg];
+		else
+			fatal(USAGE);
+		arg++;
+	}
+	if (arg != argc && argc - arg != 5) fatal(USAGE);
+
+	// connect to server
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) fatal("Socket path too long");
+	strcpy(addr.sun_path, path);
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		snprintf(err, MAXERRMSG, "Can't connect to server at %s", path);
+		fatal(err);
+	}
+	FILE *to = fdopen(sock, "w");
+	FILE *from = fdopen(dup(sock), "r");
+	assert(to != NULL && from != NULL);
+
+	// run the query on the command line, or each one from stdin
+
+	if (arg < argc) {
+		if (strcmp(argv[arg+1], "from") != 0 || strcmp(argv[arg+3], "where") != 0)
+			fatal(USAGE);
+		snprintf(query, MAXQUERYLEN, "'%s' from %s where '%s'",
+		         argv[arg], argv[arg+2], argv[arg+4]);
+		status = ask(to, from, query);
+	}
+	else {
+		while (fgets(query, MAXQUERYLEN, stdin) != NULL) {
+			Count n = strlen(query);
+			if (n > 0 && query[n-1] == '\n') query[--n] = '\0';
+			if (n == 0) continue;
+			if (ask(to, from, query) != OK) status = ~OK;
+		}
+	}
+
+	fclose(to);
+	fclose(from);
+	return (status == OK) ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+// output.c ... buffered tuple output
+// part of Multi-attribute Linear-hashed Files
+// Writes query/dump results in text or binary formats
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "defs.h"
+#include "output.h"
+
+// Output to a file descriptor is collected in OUTBUFS buffers of
+// OUTBUFSIZE bytes; a record never spans two buffers. Once they are
+// all full, they are written with a single writev(). Output to a FILE
+// (e.g. a memory stream or a socket stream) goes straight to it, since
+// stdio buffers it already.
+// Formats (lengths are 32-bit, most significant byte first):
+// - OUT_TEXT    each tuple followed by '\n'
+// - OUT_LENGTH  each tuple preceded by its length
+// - OUT_BINARY  each tuple as its number of fields, then each field
+//               as its length and its bytes (no ',' separators)
+// Text from putText() (e.g. dump's bucket headings) only appears in
+// OUT_TEXT output, so binary output holds nothing but tuples.
+
+#define OUTBUFS    8
+#define OUTBUFSIZE (32*1024)
+
+struct OutputRep {
+	int    format;   // OUT_TEXT, OUT_LENGTH or OUT_BINARY
+	int    fd;       // descriptor written to, or -1
+	FILE  *file;     // stream written to if fd < 0
+	Byte  *buf;      // OUTBUFS buffers, fd output only
+	Count  fill[OUTBUFS]; // bytes used in each buffer
+	int    cur;      // buffer being filled
+	Status status;   // OK, or ~OK once a write has failed
+};
+
+static Output newOutput(int fd, FILE *f, int format)
+{
+	Output o = malloc(sizeof(struct OutputRep));
+	assert(o != NULL);
+	o->format = format;
+	o->fd = fd;
+	o->file = f;
+	o->buf = NULL;
+	if (fd >= 0) {
+		o->buf = malloc(OUTBUFS*OUTBUFSIZE);
+		assert(o->buf != NULL);
+	}
+	memset(o->fill, 0, sizeof(o->fill));
+	o->cur = 0;
+	o->status = OK;
+	return o;
+}
+
+// output to file descriptor fd (which is not closed by closeOutput)
+
+Output openOutput(int fd, int format)
+{
+	return newOutput(fd, NULL, format);
+}
+
+// output to stream f (which is not closed by closeOutput)
+
+Output openOutputFile(FILE *f, int format)
+{
+	return newOutput(-1, f, format);
+}
+
+// format named by name ("text", "length", "binary"), or -1
+
+int outputFormat(char *name)
+{
+	if (strcmp(name, "text") == 0) return OUT_TEXT;
+	if (strcmp(name, "length") == 0) return OUT_LENGTH;
+	if (strcmp(name, "binary") == 0) return OUT_BINARY;
+	return -1;
+}
+
+int formatOf(Output o)
+{
+	return o->format;
+}
+
+// write all full buffers (and the current one) with one writev()
+
+static void flushOutput(Output o)
+{
+	struct iovec iov[OUTBUFS];
+	int n = 0;
+	for (int i = 0; i <= o->cur; i++) {
+		if (o->fill[i] == 0) continue;
+		iov[n].iov_base = o->buf + i*OUTBUFSIZE;
+		iov[n].iov_len = o->fill[i];
+		n++;
+	}
+	struct iovec *v = iov;
+	while (n > 0 && o->status == OK) {
+		ssize_t done = writev(o->fd, v, n);
+		if (done < 0) {
+			if (errno != EINTR) o->status = ~OK;
+			continue;
+		}
+		// skip what was written; writev() may stop part-way
+		while (n > 0 && (size_t)done >= v->iov_len) {
+			done -= v->iov_len;
+			v++; n--;
+		}
+		if (n > 0) {
+			v->iov_base = (Byte *)v->iov_base + done;
+			v->iov_len -= done;
+		}
+	}
+	memset(o->fill, 0, sizeof(o->fill));
+	o->cur = 0;
+}
+
+// space for a record of len bytes (len <= OUTBUFSIZE)
+
+static Byte *reserve(Output o, Count len)
+{
+	if (o->fill[o->cur] + len > OUTBUFSIZE) {
+		if (o->cur == OUTBUFS-1)
+			flushOutput(o);
+		else
+			o->cur++;
+	}
+	Byte *b = o->buf + o->cur*OUTBUFSIZE + o->fill[o->cur];
+	o->fill[o->cur] += len;
+	return b;
+}
+
+static Byte *putCount(Byte *b, Count n)
+{
+	b[0] = n >> 24; b[1] = n >> 16; b[2] = n >> 8; b[3] = n;
+	return b + 4;
+}
+
+// add raw bytes to the output
+
+void putBytes(Output o, char *s, Count len)
+{
+	if (o->fd < 0) {
+		if (fwrite(s, 1, len, o->file) != len) o->status = ~OK;
+		return;
+	}
+	while (len > 0) {
+		Count n = (len < OUTBUFSIZE) ? len : OUTBUFSIZE;
+		memcpy(reserve(o, n), s, n);
+		s += n; len -= n;
+	}
+}
+
+// add tuple t (len bytes) to the output, in the output's format
+
+void putTuple(Output o, char *t, Count len)
+{
+	// worst case: binary, with every byte a ','
+	// rows longer than any tuple (e.g. aggregates) need a bigger buffer
+	Byte buf[4 + 4*(MAXTUPLEN+1) + MAXTUPLEN + 1];
+	Byte *rec = buf;
+	if (len > MAXTUPLEN) {
+		rec = malloc(4 + 4*((size_t)len+1) + len + 1);
+		assert(rec != NULL);
+	}
+	Byte *b = rec;
+	switch (o->format) {
+	case OUT_TEXT:
+		memcpy(b, t, len); b += len;
+		*b++ = '\n';
+		break;
+	case OUT_LENGTH:
+		b = putCount(b, len);
+		memcpy(b, t, len); b += len;
+		break;
+	case OUT_BINARY: {
+		Count nf = 1;
+		for (Count i = 0; i < len; i++) {
+			if (t[i] == ',') nf++;
+		}
+		b = putCount(b, nf);
+		char *c = t, *end = t + len;
+		for (;;) {
+			char *comma = memchr(c, ',', end - c);
+			Count flen = ((comma == NULL) ? end : comma) - c;
+			b = putCount(b, flen);
+			memcpy(b, c, flen); b += flen;
+			if (comma == NULL) break;
+			c = comma + 1;
+		}
+		break;
+	}
+	}
+	putBytes(o, (char *)rec, b - rec);
+	if (rec != buf) free(rec);
+}
+
+// add text (not a tuple) to the output; only shown in OUT_TEXT format
+
+void putText(Output o, char *s)
+{
+	if (o->format == OUT_TEXT) putBytes(o, s, strlen(s));
+}
+
+// write out anything still buffered and release the Output
+// returns OK if all of the output was written
+
+Status closeOutput(Output o)
+{
+	Status status;
+	if (o->fd >= 0)
+		flushOutput(o);
+	else if (fflush(o->file) != 0)
+		o->status = ~OK;
+	status = o->status;
+	free(o->buf);
+	free(o);
+	return status;
+}
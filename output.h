@@ -0,0 +1,26 @@
+// output.h ... interface to buffered tuple output
+// part of Multi-attribute Linear-hashed Files
+// See output.c for details of Output type and functions
+
+#ifndef OUTPUT_H
+#define OUTPUT_H 1
+
+typedef struct OutputRep *Output;
+
+#include "defs.h"
+
+// output formats
+#define OUT_TEXT   0  // tuple, '\n'
+#define OUT_LENGTH 1  // 4-byte length, tuple
+#define OUT_BINARY 2  // 4-byte #fields, then per field 4-byte length, value
+
+Output openOutput(int fd, int format);
+Output openOutputFile(FILE *f, int format);
+int outputFormat(char *name);
+int formatOf(Output o);
+void putTuple(Output o, char *t, Count len);
+void putText(Output o, char *s);
+void putBytes(Output o, char *b, Count len);
+Status closeOutput(Output o);
+
+#endif
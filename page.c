@@ -3,6 +3,7 @@
 // Reading/writing pages into buffers and manipulating contents
 // Last modified by John Shepherd, July 2019
 
+#include <unistd.h>
 #include "defs.h"
 #include "page.h"
 
@@ -36,16 +37,19 @@ Page newPage()
 	return p;
 }
 
+// Page I/O uses pread/pwrite on the file's descriptor rather than
+// fseek+fread/fwrite, so that no shared file offset or stdio buffer
+// is involved and pages can be read/written from several threads
+// - callers must serialise allocation of new pages (addPage)
+
 // append a new Page to a file; return its PageID
 PageID addPage(FILE *f)
 {
-	int ok = fseek(f, 0, SEEK_END);
-	assert(ok == 0);
-	int pos = ftell(f);
+	off_t pos = lseek(fileno(f), 0, SEEK_END);
 	assert(pos >= 0);
 	PageID pid = pos/PAGESIZE;
 	Page p = newPage();
-	ok = putPage(f, pid, p);
+	int ok = putPage(f, pid, p);
 	assert(ok == 0);
 	return pid;
 }
@@ -56,20 +60,26 @@ Page getPage(FILE *f, PageID pid)
 	assert(pid >= 0);
 	Page p = malloc(PAGESIZE);
 	assert(p != NULL);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fread(p, 1, PAGESIZE, f);
+	ssize_t n = pread(fileno(f), p, PAGESIZE, (off_t)pid*PAGESIZE);
 	assert(n == PAGESIZE);
 	return p;
 }
 
+// read up to n consecutive Pages, from pid on, into buf (which
+//   holds n*PAGESIZE bytes); returns # pages read, fewer at end of file
+// the i'th Page is then (Page)(buf + i*PAGESIZE)
+Count readPages(FILE *f, PageID pid, Count n, Byte *buf)
+{
+	ssize_t got = pread(fileno(f), buf, (size_t)n*PAGESIZE, (off_t)pid*PAGESIZE);
+	assert(got >= 0);
+	return got/PAGESIZE;
+}
+
 // write a Page to a file; release allocated buffer
 Status putPage(FILE *f, PageID pid, Page p)
 {
 	assert(pid >= 0);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fwrite(p, 1, PAGESIZE, f);
+	ssize_t n = pwrite(fileno(f), p, PAGESIZE, (off_t)pid*PAGESIZE);
 	assert(n == PAGESIZE);
 	free(p);
 	return 0;
@@ -97,6 +107,7 @@ char *pageData(Page p) { return p->data; }
 Count pageNTuples(Page p) { return p->ntuples; }
 Offset pageOvflow(Page p) { return p->ovflow; }
 void pageSetOvflow(Page p, PageID pid) { p->ovflow = pid; }
+Count pageUsed(Page p) { return p->free; }
 Count pageFreeSpace(Page p) {
 	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
 	return (PAGESIZE-hdr_size-p->free);
@@ -14,6 +14,7 @@ typedef struct PageRep *Page;
 Page newPage();
 PageID addPage(FILE *);
 Page getPage(FILE *, PageID);
+Count readPages(FILE *, PageID, Count, Byte *);
 Status putPage(FILE *, PageID, Page);
 Status addToPage(Page, Tuple);
 char *pageData(Page);
@@ -21,5 +22,6 @@ Count pageNTuples(Page);
 Offset pageOvflow(Page);
 void pageSetOvflow(Page, PageID);
 Count pageFreeSpace(Page);
+Count pageUsed(Page);
 
 #endif
@@ -19,6 +19,7 @@ struct ProjectionRep {
     Count   nattrs;    // number of attributes
     int     *attrList; // used for attribute index lists
     int     projCount; // number of projected attributes
+    int     maxAttr;   // highest attribute index in attrList
     Bool    allAttrs;  // whether to project all attributes
 };
 
@@ -44,6 +45,7 @@ Projection startProjection(Reln r, char *attrstr)
         for (int i = 0; i < new->nattrs; i++) {
             new->attrList[i] = i;
         }
+        new->maxAttr = new->nattrs - 1;
         return new;
     }
 
@@ -76,33 +78,81 @@ Projection startProjection(Reln r, char *attrstr)
     }
     free(tmp);
 
+    // attribute numbers must be 1..nattrs
+    // (a bad projection mustn't bring down a long-running server)
+    new->maxAttr = -1;
+    for (int i = 0; i < count; i++) {
+        if (new->attrList[i] < 0 || new->attrList[i] >= new->nattrs) {
+            closeProjection(new);
+            return NULL;
+        }
+        if (new->attrList[i] > new->maxAttr) new->maxAttr = new->attrList[i];
+    }
+
     return new;
 }
 
-void projectTuple(Projection p, Tuple t, char *buf)
+// does the projection keep whole tuples unchanged (i.e. '*')?
+// callers can then use the tuple itself, without projecting it
+Bool projectsAll(Projection p)
+{
+    return p->allAttrs;
+}
+
+// project tuple t (*len bytes, not necessarily '\0'-terminated) into
+//   buf, which holds size bytes
+// the fields up to the last one projected are located in one pass,
+//   then the selected spans are copied, in projection order, into buf
+// sets *len to the length of the result (buf is '\0'-terminated)
+// fails, leaving *len alone, if the result would not fit in buf
+//   (repeated attributes can make it longer than any tuple)
+Status projectSpan(Projection p, char *t, Count *len, char *buf, Count size)
 {
     if (p->allAttrs) {
-        // projecting all attributes
-        strcpy(buf, t);
-        return;
+        if (*len >= size) return ~OK;
+        memcpy(buf, t, *len);
+        buf[*len] = '\0';
+        return OK;
     }
 
-    // extract the attribute values in the tuple
-    char **values = malloc(p->nattrs * sizeof(char *));
-    tupleVals(t, values);
+    // find start and length of each field that might be needed
+    char *start[p->maxAttr+1];
+    Count flen[p->maxAttr+1];
+    char *c = t, *end = t + *len;
+    int nf = 0;
+    while (nf <= p->maxAttr) {
+        char *comma = memchr(c, ',', end - c);
+        start[nf] = c;
+        flen[nf] = (comma == NULL ? end : comma) - c;
+        nf++;
+        if (comma == NULL) break;
+        c = comma + 1;
+    }
 
-    // constructing projection results
-    // initialized to an empty string
-    buf[0] = '\0';
+    // copy the selected fields
+    char *b = buf, *last = buf + size - 1;  // room for the '\0'
     for (int i = 0; i < p->projCount; i++) {
-        int attrIndex = p->attrList[i];
-
-        // adding attribute values
-        if (i > 0) strcat(buf, ",");
-        strcat(buf, values[attrIndex]);
+        int a = p->attrList[i];
+        if (i > 0) {
+            if (b == last) return ~OK;
+            *b++ = ',';
+        }
+        if (a < nf) {
+            if (flen[a] > last - b) return ~OK;
+            memcpy(b, start[a], flen[a]);
+            b += flen[a];
+        }
     }
+    *b = '\0';
+    *len = b - buf;
+    return OK;
+}
 
-    freeVals(values, p->nattrs);
+// project '\0'-terminated tuple t into buf (size bytes)
+Status projectTuple(Projection p, Tuple t, char *buf, Count size)
+{
+    Count len = strlen(t);
+    return projectSpan(p, t, &len, buf, size);
 }
 
 void closeProjection(Projection p)
@@ -12,7 +12,9 @@ typedef struct ProjectionRep *Projection;
 #include "tuple.h"
 
 Projection startProjection(Reln r, char *attrstr);
-void projectTuple(Projection p, Tuple t, char *buf);
+Status projectTuple(Projection p, Tuple t, char *buf, Count size);
+Status projectSpan(Projection p, char *t, Count *len, char *buf, Count size);
+Bool projectsAll(Projection p);
 void closeProjection(Projection p);
 
 #endif
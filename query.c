@@ -1,10 +1,27 @@
 // query.c ... run queries
 // part of Multi-attribute linear-hashed files
 // Ask a query on a named relation
-// Usage:  ./query  [-v]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
+// Usage:  ./query  [-v]  [-e]  [-t #threads]  [-o]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
 // - a1,a3,... can be '*' to indicate all attributes
+// - a1,a3,... can include count(*), min(a) and max(a), in which case
+//   any plain attributes are grouped on (see aggregate.c)
 // - Any vi can be '?' to indicate an unknown value
 // - Any vi can contain '%' as a wildcard matching zero or more characters
+// - On int and float attributes, vi can be a range: <n, <=n, >n, >=n,
+//   m..n, m.. or ..n (see select.c)
+// - Any vi can list alternatives, as in 'a|b|c'
+// - -e shows on stderr how the query would be done (hash bits, candidate
+//   buckets, expected pages, access path) without running it
+// - -v shows the same, and then runs the query
+// - -t scans candidate buckets with #threads threads
+// - -o keeps results in bucket order when scanning with threads
+// - -f chooses the output format: text (default), length or binary
+//   (see output.c)
+// - -d writes the results to file descriptor #fd instead of stdout
+// Batch usage:  ./query  -b QueryFile  'a1,a3,..'  from  RelName
+// - QueryFile holds one 'v1,v2,...' per line; the results of the
+//   query on line n go to QueryFile.n
+// - every bucket needed by any of the queries is read just once
 // Credit: John Shepherd
 // Last modified by Xiangjun Zai, Mar 2025
 
@@ -14,38 +31,118 @@
 #include "tuple.h"
 #include "reln.h"
 #include "chvec.h"
+#include "exec.h"
+#include "output.h"
 
-#define USAGE "./query  [-v]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,..."
+#define USAGE "./query  [-v]  [-e]  [-t #threads]  [-o]  [-f format]  [-d fd]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,...\n" \
+              "       ./query  [-v]  [-f format]  -b QueryFile  a1,a3,..(*)  from  RelName"
+#define MAXBATCH 1000
+
+// run every query in file qfile on r with shared bucket scans
+// results of the query on line n are written to qfile.n
+
+static void runBatch(Reln r, char *attrstr, char *qfile, int format, int verbose)
+{
+	char err[MAXERRMSG+MAXFILENAME];  // buffer for error messages
+	char line[MAXTUPLEN];  // a query from the file
+	char *vals[MAXBATCH];  // the queries
+	Count lines[MAXBATCH];  // their line numbers
+	FILE *files[MAXBATCH];  // their result files
+	Output outs[MAXBATCH];  // formatted output to each file
+	Count nq = 0, lineno = 0;
+
+	FILE *in = fopen(qfile, "r");
+	if (in == NULL) {
+		sprintf(err, "Can't open query file: %s", qfile);
+		fatal(err);
+	}
+	while (fgets(line, MAXTUPLEN, in) != NULL) {
+		lineno++;
+		Count n = strlen(line);
+		if (n > 0 && line[n-1] == '\n') line[--n] = '\0';
+		if (n == 0) continue;
+		if (nq == MAXBATCH) {
+			sprintf(err, "Too many queries in %s (max %d)", qfile, MAXBATCH);
+			fatal(err);
+		}
+		char fname[MAXFILENAME+16];
+		snprintf(fname, sizeof(fname), "%s.%d", qfile, lineno);
+		if ((files[nq] = fopen(fname, "w")) == NULL) {
+			sprintf(err, "Can't create %s", fname);
+			fatal(err);
+		}
+		// through stdio, so each file gets a small buffer
+		outs[nq] = openOutputFile(files[nq], format);
+		if (verbose) printf("%s -> %s\n", line, fname);
+		lines[nq] = lineno;
+		vals[nq++] = copyString(line);
+	}
+	fclose(in);
+
+	Count bad = nq;  // index of an invalid selection, if any
+	if (execBatch(r, attrstr, vals, nq, outs, &bad, err) != OK) {
+		if (bad < nq)
+			snprintf(err, sizeof(err), "Invalid selection on line %d: %s", lines[bad], vals[bad]);
+		fatal(err);
+	}
+	for (Count i = 0; i < nq; i++) {
+		if (closeOutput(outs[i]) != OK || fclose(files[i]) != 0)
+			fatal("Can't write results");
+		free(vals[i]);
+	}
+}
 
 // Main ... process args, run query
 
 int main(int argc, char **argv)
 {
 	Reln r;  // handle on the open relation
-	Selection s;  // handle on the selection
-	Projection p;  // handle on the projection
-	Tuple t;  // tuple pointer
 	char err[MAXERRMSG];  // buffer for error messages
-	int offset = 0; // adapt offset for -v
 	int verbose = 0;  // show extra info on query progress
+	int explain = 0;  // only show how the query would be done
+	int nthreads = 1;  // number of scan threads
+	Bool ordered = FALSE;  // keep bucket order with threads
 	char *rname;  // name of table/file
 	char *valstr;   // a query string of values for selection
 	char *attrstr;   // string of 1-based attribute indexes used for projection
+	char *batch = NULL;  // file of queries for batch mode
+	int format = OUT_TEXT;  // output format
+	int fd = 1;  // where results go
 
 	// process command-line args
 
-	if (argc < 6 || argc > 7) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc != 7) fatal(USAGE);
-		offset = 1;  verbose = 1;
+	int arg = 1;
+	while (arg < argc && argv[arg][0] == '-') {
+		if (strcmp(argv[arg], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[arg], "-e") == 0)
+			explain = 1;
+		else if (strcmp(argv[arg], "-t") == 0 && arg+1 < argc)
+			nthreads = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-o") == 0)
+			ordered = TRUE;
+		else if (strcmp(argv[arg], "-b") == 0 && arg+1 < argc)
+			batch = argv[++arg];
+		else if (strcmp(argv[arg], "-f") == 0 && arg+1 < argc) {
+			if ((format = outputFormat(argv[++arg])) < 0) fatal(USAGE);
+		}
+		else if (strcmp(argv[arg], "-d") == 0 && arg+1 < argc)
+			fd = atoi(argv[++arg]);
+		else
+			fatal(USAGE);
+		arg++;
 	}
-	if (strcmp(argv[offset+2], "from") != 0 || strcmp(argv[offset+4], "where") != 0) {
+	if (argc - arg != (batch != NULL ? 3 : 5) || (explain && batch != NULL)) fatal(USAGE);
+	if (strcmp(argv[arg+1], "from") != 0 || (batch == NULL && strcmp(argv[arg+3], "where") != 0)) {
         fatal(USAGE);
     }
-	attrstr = argv[offset+1];  rname = argv[offset+3];  valstr = argv[offset+5];
-	if (verbose) { /* keeps compiler quiet */ }
+	if (nthreads < 1) {
+		sprintf(err, "Invalid #threads: %d (must be > 0)", nthreads);
+		fatal(err);
+	}
+	attrstr = argv[arg];  rname = argv[arg+2];  valstr = (batch != NULL) ? NULL : argv[arg+4];
 
-	// initialise relation, scanning, projection structure
+	// initialise relation
 
 	if (!existsRelation(rname)) {
 		sprintf(err, "No such relation: %s",rname);
@@ -55,26 +152,27 @@ int main(int argc, char **argv)
 		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
-	if ((s = startSelection(r, valstr)) == NULL) {	
-		sprintf(err, "Invalid selection: %s",valstr);
-		fatal(err);
-	}
-	if ((p = startProjection(r, attrstr)) == NULL) {	
-		sprintf(err, "Invalid projection: %s",attrstr);
-		fatal(err);
-	}
 
 	// execute the query (find matching tuples and project on specified attributes)
 
-	char tup[MAXTUPLEN];
-	while ((t = getNextTuple(s)) != NULL) {
-		projectTuple(p,t,tup);
-		printf("%s\n",tup);
+	if (batch != NULL)
+		runBatch(r, attrstr, batch, format, verbose);
+	else {
+		if (explain || verbose) {
+			// on stderr, so it can't get mixed into the results
+			if (explainQuery(r, valstr, stderr, err) != OK)
+				fatal(err);
+		}
+		if (!explain) {
+			Output out = openOutput(fd, format);
+			if (execQuery(r, attrstr, valstr, nthreads, ordered, out, err) != OK)
+				fatal(err);
+			if (closeOutput(out) != OK)
+				fatal("Can't write results");
+		}
 	}
 
 	// clean up
-	closeProjection(p);
-	closeSelection(s);
 	closeRelation(r);
 
 	return 0;
@@ -3,6 +3,11 @@
 // Credit: John Shepherd
 // Last modified by Ziyi Shi, Apr 2025
 
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include "defs.h"
 #include "reln.h"
 #include "page.h"
@@ -10,8 +15,28 @@
 #include "chvec.h"
 #include "bits.h"
 #include "hash.h"
+#include "wal.h"
+#include "bloom.h"
+#include "hashidx.h"
+#include "bitmap.h"
 
 #define HEADERSIZE (3*sizeof(Count)+sizeof(Offset))
+#define NLATCHES   256  // bucket latches; bucket b uses latch b%NLATCHES
+#define NEXTRA     8    // #Counts in .info after the choice vector
+#define INFOSIZE   (5*sizeof(Count)+MAXCHVEC*sizeof(ChVecItem)+NEXTRA*sizeof(Count))
+#define BATCHCHUNK 1024 // most tuples placed between runs of due splits
+
+// split-pointer latch
+// shared by inserters (which rely on depth/sp staying fixed),
+//   exclusive for a split; waiting splitters block new inserters
+//   so that splits can't be starved by a steady stream of inserts
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  ok;
+	int readers;   // # inserters holding the latch
+	int waiting;   // # splitters waiting for the latch
+	Bool writing;  // a split is in progress
+} SplitLatch;
 
 struct RelnRep {
 	Count  nattrs; // number of attributes
@@ -20,22 +45,162 @@ struct RelnRep {
     Count  npages; // number of main data pages
     Count  ntups;  // total number of tuples
 	ChVec  cv;     // choice vector
+	// extra info, stored after the choice vector (0 if absent)
+	Count  flags;  // RELN_* options chosen at creation
+	Count  phase;  // partial expansions: 0 = groups 2->3, 1 = 3->4
+	Count  version;// bumped by every change to the tuples or buckets
+	Count  bitmaps;// bit a set if attribute a has a bitmap index
+	Count  types;  // TYPE_* of each attribute (see RELN_TYPE)
+	PageID freeov; // first free overflow page (NO_PAGE if none)
+	Count  novflow;// number of overflow pages in bucket chains
+	Count  stamp;  // set at creation; differs if the relation is recreated
 	char   mode;   // open for read/write
+	char   name[MAXRELNAME+1]; // relation name
+	Bloom  bloom;  // per-bucket value filters (NULL if none)
+	HashIndex hindex; // secondary indexes (NULL if none)
+	BitmapIndex bmap; // bitmap indexes (NULL if none)
 	FILE  *info;   // handle on info file
 	FILE  *data;   // handle on data file
 	FILE  *ovflow; // handle on ovflow file
+	// latches for concurrent inserts (not stored in .info)
+	SplitLatch      splitLatch;          // guards depth, sp, npages
+	pthread_mutex_t bucketLatch[NLATCHES]; // guard bucket page chains
+	pthread_mutex_t allocLatch;          // guards ovflow page allocation
+	pthread_mutex_t countLatch;          // guards ntups
+	// write-ahead logging (writers only; NULL otherwise)
+	Wal    wal;          // log + pages modified since last commit
+	pthread_mutex_t commitLatch; // guards the group commit state
+	pthread_cond_t  committed;   // signalled when a group is durable
+	Count  ncompleted;   // #insert calls completed
+	Count  ndurable;     // #insert calls known to be durable
+	Bool   flushing;     // a group commit is in progress
 };
 
+// set up/release the in-memory latches for a relation
+
+static void initLatches(Reln r)
+{
+	pthread_mutex_init(&r->splitLatch.lock, NULL);
+	pthread_cond_init(&r->splitLatch.ok, NULL);
+	r->splitLatch.readers = r->splitLatch.waiting = 0;
+	r->splitLatch.writing = FALSE;
+	for (int i = 0; i < NLATCHES; i++)
+		pthread_mutex_init(&r->bucketLatch[i], NULL);
+	pthread_mutex_init(&r->allocLatch, NULL);
+	pthread_mutex_init(&r->countLatch, NULL);
+	pthread_mutex_init(&r->commitLatch, NULL);
+	pthread_cond_init(&r->committed, NULL);
+	r->ncompleted = r->ndurable = 0;
+	r->flushing = FALSE;
+}
+
+static void destroyLatches(Reln r)
+{
+	pthread_mutex_destroy(&r->splitLatch.lock);
+	pthread_cond_destroy(&r->splitLatch.ok);
+	for (int i = 0; i < NLATCHES; i++)
+		pthread_mutex_destroy(&r->bucketLatch[i]);
+	pthread_mutex_destroy(&r->allocLatch);
+	pthread_mutex_destroy(&r->countLatch);
+	pthread_mutex_destroy(&r->commitLatch);
+	pthread_cond_destroy(&r->committed);
+}
+
+static void latchShared(SplitLatch *l)
+{
+	pthread_mutex_lock(&l->lock);
+	while (l->writing || l->waiting > 0)
+		pthread_cond_wait(&l->ok, &l->lock);
+	l->readers++;
+	pthread_mutex_unlock(&l->lock);
+}
+
+static void unlatchShared(SplitLatch *l)
+{
+	pthread_mutex_lock(&l->lock);
+	if (--l->readers == 0) pthread_cond_broadcast(&l->ok);
+	pthread_mutex_unlock(&l->lock);
+}
+
+static void latchExclusive(SplitLatch *l)
+{
+	pthread_mutex_lock(&l->lock);
+	l->waiting++;
+	while (l->writing || l->readers > 0)
+		pthread_cond_wait(&l->ok, &l->lock);
+	l->waiting--;
+	l->writing = TRUE;
+	pthread_mutex_unlock(&l->lock);
+}
+
+static void unlatchExclusive(SplitLatch *l)
+{
+	pthread_mutex_lock(&l->lock);
+	l->writing = FALSE;
+	pthread_cond_broadcast(&l->ok);
+	pthread_mutex_unlock(&l->lock);
+}
+
+// does the relation have secondary indexes (hash, ordered or trigram)?
+
+static Bool hasIndexes(Reln r)
+{
+	return (RELN_INDEXED(r->flags) | RELN_ORDERED(r->flags) | RELN_TRIGRAMS(r->flags)) != 0;
+}
+
+// open the secondary indexes of relation name (see hashidx.c)
+// ordered indexes also answer exact-match lookups
+
+static HashIndex openIndexes(Reln r, char *name, Bool writer, Bool *stale)
+{
+	Count ordered = RELN_ORDERED(r->flags);
+	return hindexOpen(name, r->nattrs, RELN_INDEXED(r->flags) | ordered, ordered,
+	                  RELN_TRIGRAMS(r->flags), writer, stale);
+}
+
 // create a new relation (three files)
 
-Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv)
+Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv, Count flags, Count bitmaps, Count types)
 {
     char fname[MAXFILENAME];
 	Reln r = malloc(sizeof(struct RelnRep));
+	assert(r != NULL);
+	// partial expansions need at least one group of two buckets
+	if ((flags & RELN_PARTIAL) && d == 0) { d = 1; npages = 2; }
 	r->nattrs = nattrs; r->depth = d; r->sp = 0;
 	r->npages = npages; r->ntups = 0; r->mode = 'w';
-	assert(r != NULL);
+	r->flags = flags; r->phase = 0; r->version = 0;
+	r->bitmaps = bitmaps; r->types = types;
+	r->freeov = NO_PAGE;
+	r->novflow = 0;
+	// time and pid, so creating the relation again gives a new stamp
+	r->stamp = (Count)time(NULL) ^ ((Count)getpid() << 16);
 	if (parseChVec(r, cv, r->cv) != OK) return ~OK;
+	initLatches(r);
+	r->wal = NULL;
+	r->bloom = NULL;
+	r->hindex = NULL;
+	r->bmap = NULL;
+	Bool stale;
+	// don't pick up filters or indexes left by an old relation of that name
+	if (flags & RELN_BLOOM) {
+		sprintf(fname,"%s.bloom",name);
+		remove(fname);
+		r->bloom = bloomOpen(name, nattrs, npages, TRUE, &stale);
+		assert(r->bloom != NULL);
+	}
+	if (hasIndexes(r)) {
+		sprintf(fname,"%s.hidx",name);
+		remove(fname);
+		r->hindex = openIndexes(r, name, TRUE, &stale);
+		assert(r->hindex != NULL);
+	}
+	if (bitmaps != 0) {
+		sprintf(fname,"%s.bmap",name);
+		remove(fname);
+		r->bmap = bmapOpen(name, nattrs, bitmaps, TRUE, &stale);
+		assert(r->bmap != NULL);
+	}
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,"w");
 	assert(r->info != NULL);
@@ -66,7 +231,61 @@ Bool existsRelation(char *name)
 	}
 }
 
+// recompute the Bloom filters (if bloom), the secondary indexes
+//   (if index) and the bitmap indexes (if bitmap) from the tuples in
+//   every bucket
+// used when the saved ones can't be trusted (e.g. after a crash)
+
+static void rebuildAccess(Reln r, Bool bloom, Bool index, Bool bitmap)
+{
+	if (index) hindexClear(r->hindex);
+	if (bitmap) bmapClear(r->bmap);
+	for (PageID b = 0; b < r->npages; b++) {
+		if (bloom) bloomClear(r->bloom, b);
+		FILE *f = r->data;
+		PageID pid = b;
+		while (pid != NO_PAGE) {
+			Page p = getPage(f, pid);
+			char *c = pageData(p);
+			for (Count i = 0; i < pageNTuples(p); i++) {
+				if (bloom) bloomAddTuple(r->bloom, b, c);
+				IndexLoc loc = { b, (f == r->data) ? NO_PAGE : pid, i };
+				if (index) hindexAddTuple(r->hindex, loc, c);
+				if (bitmap) bmapAddTuple(r->bmap, loc, c);
+				c += strlen(c) + 1;
+			}
+			pid = pageOvflow(p);
+			free(p);
+			f = r->ovflow;
+		}
+	}
+}
+
+// number of overflow pages in bucket chains, found by walking them
+// only needed for relations saved before the count was kept in .info
+
+static Count countOvflowPages(Reln r)
+{
+	Count n = 0;
+	for (PageID b = 0; b < r->npages; b++) {
+		Page p = getPage(r->data, b);
+		PageID pid = pageOvflow(p);
+		free(p);
+		while (pid != NO_PAGE) {
+			n++;
+			p = getPage(r->ovflow, pid);
+			pid = pageOvflow(p);
+			free(p);
+		}
+	}
+	return n;
+}
+
 // set up a relation descriptor from relation name
+// relations opened for writing log all their updates; a writer holds
+//   an exclusive flock on the .info file until it closes, and replays
+//   any committed updates left in the log by a crashed writer first
+// readers take no lock and never touch the log
 
 Reln openRelation(char *name, char *mode)
 {
@@ -77,6 +296,12 @@ Reln openRelation(char *name, char *mode)
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,mode);
 	assert(r->info != NULL);
+	r->mode = (mode[0] == 'w' || mode[1] =='+') ? 'w' : 'r';
+	if (r->mode == 'w') {
+		int ok = flock(fileno(r->info), LOCK_EX);
+		assert(ok == 0);
+		walRecover(name);
+	}
 	sprintf(fname,"%s.data",name);
 	r->data = fopen(fname,mode);
 	assert(r->data != NULL);
@@ -88,206 +313,732 @@ Reln openRelation(char *name, char *mode)
 	assert(n == 5);
 	n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
 	assert(n == MAXCHVEC);
-	r->mode = (mode[0] == 'w' || mode[1] =='+') ? 'w' : 'r';
+	// relations from before extra info was added have none
+	Count extra[NEXTRA] = { 0, 0, 0, 0, 0, NO_PAGE, NO_PAGE, 0 };
+	n = fread(extra, sizeof(Count), NEXTRA, r->info);
+	r->flags = extra[0]; r->phase = extra[1]; r->version = extra[2];
+	r->bitmaps = extra[3]; r->types = extra[4]; r->freeov = extra[5];
+	r->novflow = extra[6]; r->stamp = extra[7];
+	if (r->novflow == NO_PAGE) r->novflow = countOvflowPages(r);
+	snprintf(r->name, sizeof(r->name), "%s", name);
+	initLatches(r);
+	r->wal = (r->mode == 'w') ? walOpen(name, r->data, r->ovflow, r->info) : NULL;
+	r->bloom = NULL;
+	r->hindex = NULL;
+	r->bmap = NULL;
+	Bool staleBloom = FALSE, staleIndex = FALSE, staleBitmap = FALSE;
+	if (r->flags & RELN_BLOOM)
+		r->bloom = bloomOpen(name, r->nattrs, r->npages, r->mode == 'w', &staleBloom);
+	if (hasIndexes(r))
+		r->hindex = openIndexes(r, name, r->mode == 'w', &staleIndex);
+	if (r->bitmaps != 0)
+		r->bmap = bmapOpen(name, r->nattrs, r->bitmaps, r->mode == 'w', &staleBitmap);
+	staleBloom = staleBloom && r->bloom != NULL;
+	staleIndex = staleIndex && r->hindex != NULL;
+	staleBitmap = staleBitmap && r->bmap != NULL;
+	if (staleBloom || staleIndex || staleBitmap)
+		rebuildAccess(r, staleBloom, staleIndex, staleBitmap);
 	return r;
 }
 
+// read the current .info header (and choice vector) of a relation
+//   opened for reading
+// returns FALSE if it is the one the relation already has
+
+static Bool readInfoHeader(Reln r, Count *hdr, ChVec cv, Count *extra)
+{
+	if (r->mode != 'r') return FALSE;
+	Byte info[INFOSIZE];
+	ssize_t n = pread(fileno(r->info), info, INFOSIZE, 0);
+	if (n < 5*sizeof(Count)) return FALSE;
+	memcpy(hdr, info, 5*sizeof(Count));
+	// values missing from the file stay as they are
+	Count cur[NEXTRA] = { r->flags, r->phase, r->version, r->bitmaps, r->types, r->freeov, r->novflow, r->stamp };
+	memcpy(extra, cur, sizeof(cur));
+	memcpy(cv, r->cv, sizeof(ChVec));
+	Count off = 5*sizeof(Count);
+	if (n >= off+sizeof(ChVec)) memcpy(cv, info+off, sizeof(ChVec));
+	off += sizeof(ChVec);
+	if (n > off) memcpy(extra, info+off, (n-off < NEXTRA*sizeof(Count)) ? n-off : NEXTRA*sizeof(Count));
+	// Naughty: assumes Count and Offset are the same size
+	return memcmp(hdr, r, 5*sizeof(Count)) != 0 || extra[1] != r->phase
+	       || extra[2] != r->version || extra[7] != r->stamp;
+}
+
+// has the relation's .info file been replaced (the relation removed
+//   and created again) since it was opened?
+
+static Bool infoReplaced(Reln r)
+{
+	char fname[MAXFILENAME];
+	struct stat was, now;
+	sprintf(fname,"%s.info",r->name);
+	if (fstat(fileno(r->info), &was) != 0 || stat(fname, &now) != 0)
+		return FALSE;
+	return was.st_ino != now.st_ino || was.st_dev != now.st_dev;
+}
+
+// switch a relation opened for reading over to its current files
+// FALSE (keeping the old ones) if they aren't all there yet
+
+static Bool reopenFiles(Reln r)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname,"%s.info",r->name);
+	FILE *info = fopen(fname,"r");
+	sprintf(fname,"%s.data",r->name);
+	FILE *data = fopen(fname,"r");
+	sprintf(fname,"%s.ovflow",r->name);
+	FILE *ovflow = fopen(fname,"r");
+	if (info == NULL || data == NULL || ovflow == NULL) {
+		if (info != NULL) fclose(info);
+		if (data != NULL) fclose(data);
+		if (ovflow != NULL) fclose(ovflow);
+		return FALSE;
+	}
+	fclose(r->info); fclose(r->data); fclose(r->ovflow);
+	r->info = info; r->data = data; r->ovflow = ovflow;
+	return TRUE;
+}
+
+// has a relation opened for reading been changed since it was opened
+//   (or last refreshed)?
+// only looks at the .info file; changes nothing, so callers sharing
+//   the relation can check without excluding each other
+
+Bool relationChanged(Reln r)
+{
+	Count hdr[5], extra[NEXTRA];
+	ChVec cv;
+	if (r->mode == 'r' && infoReplaced(r)) return TRUE;
+	return readInfoHeader(r, hdr, cv, extra);
+}
+
+// bring a relation opened for reading up to date with changes made
+//   since it was opened (by writers in other processes)
+// only the .info header is re-read, so this is cheap enough to do
+//   before every query in a long-running server
+// returns TRUE if the relation had changed
+
+Bool refreshRelation(Reln r)
+{
+	Count hdr[5], extra[NEXTRA];
+	ChVec cv;
+	// a relation created again has new files (and a new stamp)
+	if (r->mode == 'r' && infoReplaced(r) && !reopenFiles(r)) return FALSE;
+	if (!readInfoHeader(r, hdr, cv, extra)) return FALSE;
+	memcpy(r, hdr, sizeof(hdr));
+	r->phase = extra[1];
+	r->version = extra[2];
+	r->novflow = extra[6];
+	if (extra[7] != r->stamp) {
+		// recreated: the options may have changed along with the tuples
+		if (r->bloom != NULL) { bloomClose(r->bloom); r->bloom = NULL; }
+		if (r->hindex != NULL) { hindexClose(r->hindex); r->hindex = NULL; }
+		if (r->bmap != NULL) { bmapClose(r->bmap); r->bmap = NULL; }
+		memcpy(r->cv, cv, sizeof(ChVec));
+		r->flags = extra[0]; r->bitmaps = extra[3]; r->types = extra[4];
+		r->stamp = extra[7];
+	}
+	// saved filters and indexes may no longer describe the buckets
+	Bool stale;
+	if (r->flags & RELN_BLOOM) {
+		if (r->bloom != NULL) bloomClose(r->bloom);
+		r->bloom = bloomOpen(r->name, r->nattrs, r->npages, FALSE, &stale);
+	}
+	if (hasIndexes(r)) {
+		if (r->hindex != NULL) hindexClose(r->hindex);
+		r->hindex = openIndexes(r, r->name, FALSE, &stale);
+	}
+	if (r->bitmaps != 0) {
+		if (r->bmap != NULL) bmapClose(r->bmap);
+		r->bmap = bmapOpen(r->name, r->nattrs, r->bitmaps, FALSE, &stale);
+	}
+	return TRUE;
+}
+
+// build the contents of the .info file in buf
+// Naughty: assumes Count and Offset are the same size
+
+static Count infoImage(Reln r, Byte *buf)
+{
+	// core relation info (#attr,d,sp,#pages,#tuples)
+	memcpy(buf, r, 5*sizeof(Count));
+	// choice vector
+	Byte *b = buf+5*sizeof(Count);
+	memcpy(b, r->cv, MAXCHVEC*sizeof(ChVecItem));
+	// extra info
+	Count extra[NEXTRA] = { r->flags, r->phase, r->version, r->bitmaps, r->types, r->freeov, r->novflow, r->stamp };
+	memcpy(b+MAXCHVEC*sizeof(ChVecItem), extra, sizeof(extra));
+	return INFOSIZE;
+}
+
 // release files and descriptor for an open relation
 // copy latest information to .info file
 
 void closeRelation(Reln r)
 {
 	// make sure updated global data is put in info
-	// Naughty: assumes Count and Offset are the same size
+	Byte info[INFOSIZE];
+	Count len = infoImage(r, info);
+	if (r->wal != NULL) {
+		// force everything to the files; log no longer needed
+		Status ok = walCheckpoint(r->wal, info, len);
+		assert(ok == OK);
+		walClose(r->wal);
+	}
+	// filters and indexes are saved only once the pages they describe are safe
+	if (r->bloom != NULL) bloomClose(r->bloom);
+	if (r->hindex != NULL) hindexClose(r->hindex);
+	if (r->bmap != NULL) bmapClose(r->bmap);
 	if (r->mode == 'w') {
 		fseek(r->info, 0, SEEK_SET);
-		// write out core relation info (#attr,#pages,d,sp)
-		int n = fwrite(r, sizeof(Count), 5, r->info);
-		assert(n == 5);
-		// write out choice vector
-		n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
-		assert(n == MAXCHVEC);
+		int n = fwrite(info, 1, len, r->info);
+		assert(n == len);
 	}
 	fclose(r->info);
 	fclose(r->data);
 	fclose(r->ovflow);
+	destroyLatches(r);
 	free(r);
 }
 
-PageID insertTupleIntoPageChain(Reln r, PageID p, Tuple t) {
-    Page pg = getPage(r->data,p);
-    if (addToPage(pg,t) == OK) {
-        putPage(r->data,p,pg);
-        return p;
+// page access for updates
+// while a relation is being logged, modified pages are held by the
+//   Wal until their group commits, so reads must look there first
+
+static Page relGetPage(Reln r, FILE *f, PageID pid)
+{
+    if (r->wal != NULL) {
+        Page p = walGetPage(r->wal, (f == r->data) ? WAL_DATA : WAL_OVFLOW, pid);
+        if (p != NULL) return p;
     }
-    // primary data page full
-    if (pageOvflow(pg) == NO_PAGE) {
-        // add first overflow page in chain
-        PageID newp = addPage(r->ovflow);
-        pageSetOvflow(pg,newp);
-        putPage(r->data,p,pg);
-        Page newpg = getPage(r->ovflow,newp);
-        // can't add to a new page; we have a problem
-        if (addToPage(newpg,t) != OK) return NO_PAGE;
-        putPage(r->ovflow,newp,newpg);
-        return p;
+    return getPage(f, pid);
+}
+
+static void relPutPage(Reln r, FILE *f, PageID pid, Page p)
+{
+    if (r->wal != NULL)
+        walPutPage(r->wal, (f == r->data) ? WAL_DATA : WAL_OVFLOW, pid, p);
+    else
+        putPage(f, pid, p);
+}
+
+// make the inserts completed so far durable (group commit)
+// the first caller to find no commit in progress becomes the leader:
+//   it waits for in-flight inserts to finish (split latch exclusive)
+//   and commits everything completed by then with a single fsync;
+//   callers whose inserts were covered by that group just wait
+
+static void commitInserts(Reln r)
+{
+    pthread_mutex_lock(&r->commitLatch);
+    Count mine = ++r->ncompleted;
+    while (r->ndurable < mine) {
+        if (r->flushing) {
+            pthread_cond_wait(&r->committed, &r->commitLatch);
+            continue;
+        }
+        r->flushing = TRUE;
+        pthread_mutex_unlock(&r->commitLatch);
+
+        latchExclusive(&r->splitLatch);
+        pthread_mutex_lock(&r->commitLatch);
+        Count upto = r->ncompleted;
+        pthread_mutex_unlock(&r->commitLatch);
+        Byte info[INFOSIZE];
+        Count len = infoImage(r, info);
+        Status ok = walFull(r->wal) ? walCheckpoint(r->wal, info, len)
+                                    : walFlush(r->wal, info, len);
+        if (ok != OK) fatal("Can't write log");
+        unlatchExclusive(&r->splitLatch);
+
+        pthread_mutex_lock(&r->commitLatch);
+        r->ndurable = upto;
+        r->flushing = FALSE;
+        pthread_cond_broadcast(&r->committed);
     }
+    pthread_mutex_unlock(&r->commitLatch);
+}
+
+// Free overflow pages
+// Overflow pages that a split empties are no longer in any chain.
+// They are kept on a free list, linked through their ovflow fields,
+// whose head is saved in .info; a free page holds no tuples. New
+// overflow pages come from the free list first, and the file only
+// grows when it is empty.
+
+// get an empty overflow page, from the free list if it has one,
+//   otherwise appended to the overflow file
+// allocation is serialised, since inserters in different buckets
+//   may extend their chains at the same time
+
+static PageID newOvflowPage(Reln r)
+{
+    pthread_mutex_lock(&r->allocLatch);
+    PageID pid = r->freeov;
+    r->novflow++;
+    if (pid == NO_PAGE)
+        pid = addPage(r->ovflow);
     else {
-        // scan overflow chain until we find space
-        // worst case: add new ovflow page at end of chain
-        Page ovpg, prevpg = NULL;
-        PageID ovp, prevp = NO_PAGE;
-        ovp = pageOvflow(pg);
-        free(pg);
-        while (ovp != NO_PAGE) {
-            ovpg = getPage(r->ovflow, ovp);
-            if (addToPage(ovpg,t) != OK) {
-                if (prevpg != NULL) free(prevpg);
-                prevp = ovp; prevpg = ovpg;
-                ovp = pageOvflow(ovpg);
-            }
-            else {
-                if (prevpg != NULL) free(prevpg);
-                putPage(r->ovflow,ovp,ovpg);
-                return p;
+        Page p = relGetPage(r, r->ovflow, pid);
+        r->freeov = pageOvflow(p);
+        free(p);
+        p = newPage();
+        relPutPage(r, r->ovflow, pid, p);
+    }
+    pthread_mutex_unlock(&r->allocLatch);
+    return pid;
+}
+
+// put overflow page pid, which is in no chain, on the free list
+
+static void freeOvflowPage(Reln r, PageID pid)
+{
+    pthread_mutex_lock(&r->allocLatch);
+    Page p = newPage();
+    pageSetOvflow(p, r->freeov);
+    relPutPage(r, r->ovflow, pid, p);
+    r->freeov = pid;
+    r->novflow--;
+    pthread_mutex_unlock(&r->allocLatch);
+}
+
+// insert a group of tuples into the page chain for bucket p
+// walks the chain once; each page takes, in order, every remaining
+//   tuple that still fits (same placement as first-fit one-at-a-time)
+// each modified page is written exactly once
+// returns number of tuples placed; unplaced tuples are left
+//   (in order) at the front of ts[]
+
+static Count insertTuplesIntoPageChain(Reln r, PageID p, Tuple *ts, Count n)
+{
+    FILE *f = r->data;
+    PageID pid = p;
+    Page pg = relGetPage(r, f, pid);
+    Count left = n;
+    for (;;) {
+        Bool dirty = FALSE;
+        Count i, kept = 0;
+        for (i = 0; i < left; i++) {
+            if (addToPage(pg, ts[i]) == OK) {
+                dirty = TRUE;
+                if (r->bloom != NULL) bloomAddTuple(r->bloom, p, ts[i]);
+                IndexLoc loc = { p, (f == r->data) ? NO_PAGE : pid, pageNTuples(pg)-1 };
+                if (r->hindex != NULL) hindexAddTuple(r->hindex, loc, ts[i]);
+                if (r->bmap != NULL) bmapAddTuple(r->bmap, loc, ts[i]);
             }
+            else
+                ts[kept++] = ts[i];
         }
-        // all overflow pages are full; add another to chain
-        // at this point, there *must* be a prevpg
-        assert(prevpg != NULL);
-        // make new ovflow page
-        PageID newp = addPage(r->ovflow);
-        // insert tuple into new page
-        Page newpg = getPage(r->ovflow,newp);
-        if (addToPage(newpg,t) != OK) return NO_PAGE;
-        putPage(r->ovflow,newp,newpg);
-        // link to existing overflow chain
-        pageSetOvflow(prevpg,newp);
-        putPage(r->ovflow,prevp,prevpg);
-        return p;
+        left = kept;
+        // nothing left, or even an empty page can't take the rest
+        if (left == 0 || (pageNTuples(pg) == 0 && f == r->ovflow)) {
+            if (dirty) relPutPage(r, f, pid, pg); else free(pg);
+            return n - left;
+        }
+        PageID next = pageOvflow(pg);
+        if (next == NO_PAGE) {
+            next = newOvflowPage(r);
+            pageSetOvflow(pg, next);
+            dirty = TRUE;
+        }
+        if (dirty) relPutPage(r, f, pid, pg); else free(pg);
+        f = r->ovflow; pid = next;
+        pg = relGetPage(r, f, pid);
     }
 }
 
-// insert a new tuple into a relation
-// returns index of bucket where inserted
-// - index always refers to a primary data page
-// - the actual insertion page may be either a data page or an overflow page
-// returns NO_PAGE if insert fails completely
-// TODO: include splitting and file expansion
-PageID addToRelation(Reln r, Tuple t)
+// Addressing
+// Classic linear hashing (the default) splits one bucket at a time:
+//   buckets before the split pointer use d+1 hash bits, the rest d.
+// With partial expansions (RELN_PARTIAL), the 2^d buckets of a file
+//   at depth d form N = 2^(d-1) groups {g, g+N}; the file grows in two
+//   partial expansions, each of which adds one bucket to every group
+//   in turn (g+2N in phase 0, g+3N in phase 1), redistributing all
+//   of the group's tuples among its buckets; sp points at the next
+//   group to expand. After phase 1 the file is at depth d+1 again
+//   with groups of two. Within a group, a tuple's position depends on
+//   hash bits d-1 and d (k) and bits d+1..d+4 (e):
+//   - 2 buckets: bit d-1 (as classic linear hashing)
+//   - 3 buckets: k if k < 2, else 0/1 for about 5/16 of tuples (by e)
+//                and 2 for the rest, so all three get ~1/3 of the load
+//   - 4 buckets: k (i.e. classic addressing with d+1 bits)
+// So loads within the file differ by at most 4:3, rather than 2:1.
+
+// number of groups in a partially-expanded file
+
+static Count ngroups(Reln r)
+{
+    return 1 << (r->depth - 1);
+}
+
+// number of buckets in group g of a partially-expanded file
+
+Count groupSize(Reln r, PageID g)
 {
-    Bits h, p;
-    //char buf[MAXBITS+5]; //*** for debug
-    h = tupleHash(r,t);  // Returns Bits - tuple's hash value
-    if (r->depth == 0)
+    if (r->phase == 0)
+        return (g < r->sp) ? 3 : 2;
+    else
+        return (g < r->sp) ? 4 : 3;
+}
+
+// position within a group of size buckets of a tuple with hash h
+//   in a partially-expanded file of depth d
+
+Count groupPosition(Bits h, Count d, Count size)
+{
+    Count k = (h >> (d-1)) & 0x3;
+    Count e = (h >> (d+1)) & 0xf;
+    switch (size) {
+    case 2: return k & 0x1;
+    case 3: return (k < 2) ? k : (e < 5) ? k-2 : 2;
+    default: return k;
+    }
+}
+
+// compute the bucket (primary page) for a tuple hash
+
+PageID bucketOf(Reln r, Bits h)
+{
+    PageID p;
+    if (r->flags & RELN_PARTIAL) {
+        Count N = ngroups(r);
+        PageID g = h & (N-1);
+        p = g + N*groupPosition(h, r->depth, groupSize(r, g));
+    }
+    else if (r->depth == 0)
         p = 0;
     else {
-        p = getLower(h, r->depth);  // Returns Bits - extracts lower bits from hash value
-        if (p < r->sp) p = getLower(h, r->depth+1);  // Returns Bits
+        // buckets before the split pointer use one extra bit
+        p = getLower(h, r->depth);
+        if (p < r->sp) p = getLower(h, r->depth+1);
     }
-    // bitsString(h,buf); printf("hash = %s\n",buf); //*** for debug
-    // bitsString(p,buf); printf("page = %s\n",buf); //*** for debug
-
-    p = insertTupleIntoPageChain(r, p, t);  // Returns PageID - page where tuple was inserted
-    if (p != NO_PAGE) {
-        r->ntups++;
-        Count c = 1024 / (10 * nattrs(r));  // nattrs() returns Count - number of attributes
-        if (r->ntups > 0 && r->ntups % c == 0) {
-            // Split the old bucket
-            PageID newPageId = r->sp + (1 << r->depth); // new page ID sp + 2^d
-            PageID oldPageId = r->sp; // old page id
-
-            // Creating a new bucket
-            Page newPageObj = newPage();
-            r->npages++;
-            putPage(r->data, newPageId, newPageObj);
-
-            // Get the old bucket and its overflow chain
-            Page oldPageObj = getPage(r->data, oldPageId);
-            PageID ovflowID = pageOvflow(oldPageObj);
-
-            // Collect all the tuples
-            int maxTuples = pageNTuples(oldPageObj);
-            PageID currentOvp_for_count = ovflowID;
-            while (currentOvp_for_count != NO_PAGE) {
-                Page ovPage = getPage(r->ovflow, currentOvp_for_count);
-                maxTuples += pageNTuples(ovPage);
-                currentOvp_for_count = pageOvflow(ovPage);
-                free(ovPage);
-            }
+    return p;
+}
 
-            char **tuples = malloc(sizeof(char*) * maxTuples);
-            assert(tuples != NULL);
-            int ntuples = 0;
+// number of insertions between successive splits
 
-            // Collect tuples from the master data page
-            char *c = pageData(oldPageObj);
-            for (int i = 0; i < pageNTuples(oldPageObj); i++) {
-                tuples[ntuples++] = copyString(c);
-                c += strlen(c) + 1;
-            }
+static Count splitInterval(Reln r)
+{
+    return 1024 / (10 * nattrs(r));
+}
 
-            PageID currentOvp = ovflowID;
-            while (currentOvp != NO_PAGE) {
-                Page ovPage = getPage(r->ovflow, currentOvp);
-                c = pageData(ovPage);
-                for (int i = 0; i < pageNTuples(ovPage); i++) {
-                    tuples[ntuples++] = copyString(c);
-                    c += strlen(c) + 1;
-                }
-                PageID nextOvp = pageOvflow(ovPage);
-                free(ovPage);
-                currentOvp = nextOvp;
-            }
+// count k newly inserted tuples (a change, if k > 0)
+// returns the number of splits that have become due
 
+static Count countInserted(Reln r, Count k)
+{
+    Count c = splitInterval(r);
+    pthread_mutex_lock(&r->countLatch);
+    Count before = r->ntups / c;
+    r->ntups += k;
+    if (k > 0) r->version++;
+    Count due = r->ntups / c - before;
+    pthread_mutex_unlock(&r->countLatch);
+    return due;
+}
 
-            PageID firstOverflowID = pageOvflow(oldPageObj);
-            PageID cur_OverflowPage_ID = firstOverflowID;
-            Page emptyPageObj = newPage();
-            pageSetOvflow(emptyPageObj, firstOverflowID);
-            putPage(r->data, oldPageId, emptyPageObj);
+// ordering on (bucket,position) for grouping a batch
 
+typedef struct { PageID bucket; Count pos; } BatchItem;
 
-            while (cur_OverflowPage_ID != NO_PAGE) {
-                Page currOvPage = getPage(r->ovflow, cur_OverflowPage_ID);
-                assert(currOvPage != NULL);
+static int cmpBatchItem(const void *a, const void *b)
+{
+    const BatchItem *x = a, *y = b;
+    if (x->bucket != y->bucket) return (x->bucket < y->bucket) ? -1 : 1;
+    return (x->pos < y->pos) ? -1 : (x->pos > y->pos);
+}
 
-                PageID nextOvID = pageOvflow(currOvPage);
+// collect all tuples in bucket b (data page and overflow chain),
+//   appending copies to *tuples (grown as needed), then empty the pages
+// the data page keeps its link to the first, now empty, overflow page
+//   (the tuples going back into b will probably need it); the rest of
+//   the old chain goes on the free list
 
-                free(currOvPage);
+static void takeBucket(Reln r, PageID b, Tuple **tuples, Count *ntuples, Count *size)
+{
+    // Get the old bucket and its overflow chain
+    Page oldPageObj = relGetPage(r, r->data, b);
+    PageID ovflowID = pageOvflow(oldPageObj);
 
-                Page newOvPage = newPage();
+    // Count the tuples
+    Count first = *ntuples;
+    Count maxTuples = *ntuples + pageNTuples(oldPageObj);
+    PageID currentOvp_for_count = ovflowID;
+    while (currentOvp_for_count != NO_PAGE) {
+        Page ovPage = relGetPage(r, r->ovflow, currentOvp_for_count);
+        maxTuples += pageNTuples(ovPage);
+        currentOvp_for_count = pageOvflow(ovPage);
+        free(ovPage);
+    }
+    if (maxTuples > *size) {
+        *size = maxTuples;
+        *tuples = realloc(*tuples, sizeof(Tuple) * (*size));
+        assert(*tuples != NULL);
+    }
 
-                pageSetOvflow(newOvPage, NO_PAGE);
+    // Collect tuples from the master data page
+    char *c = pageData(oldPageObj);
+    for (int i = 0; i < pageNTuples(oldPageObj); i++) {
+        (*tuples)[(*ntuples)++] = copyString(c);
+        c += strlen(c) + 1;
+    }
+    free(oldPageObj);
 
-                putPage(r->ovflow, cur_OverflowPage_ID, newOvPage);
+    // Collect tuples from the overflow pages, emptying them as we go
+    PageID currentOvp = ovflowID;
+    while (currentOvp != NO_PAGE) {
+        Page ovPage = relGetPage(r, r->ovflow, currentOvp);
+        c = pageData(ovPage);
+        for (int i = 0; i < pageNTuples(ovPage); i++) {
+            (*tuples)[(*ntuples)++] = copyString(c);
+            c += strlen(c) + 1;
+        }
+        PageID nextOvp = pageOvflow(ovPage);
+        free(ovPage);
+        if (currentOvp == ovflowID) {
+            Page newOvPage = newPage();
+            pageSetOvflow(newOvPage, NO_PAGE);
+            relPutPage(r, r->ovflow, currentOvp, newOvPage);
+        }
+        else
+            freeOvflowPage(r, currentOvp);
+        currentOvp = nextOvp;
+    }
 
-                cur_OverflowPage_ID = nextOvID;
-            }
+    Page emptyPageObj = newPage();
+    pageSetOvflow(emptyPageObj, ovflowID);
+    relPutPage(r, r->data, b, emptyPageObj);
+    if (r->bloom != NULL) bloomClear(r->bloom, b);
+    if (r->hindex != NULL)
+        hindexRemoveTuples(r->hindex, b, *tuples + first, *ntuples - first);
+    if (r->bmap != NULL) bmapRemoveBucket(r->bmap, b);
+}
 
-            // Reallocate all tuples
-            for (int i = 0; i < ntuples; i++) {
-                Tuple t = tuples[i];
-                Bits h = tupleHash(r, t);
-                // Use an extra bit to determine the bucket number
-                Bits newPid = getLower(h, r->depth + 1);
-                insertTupleIntoPageChain(r, newPid, t);
-                free(t);
-            }
+// place tuples in their buckets, one chain traversal per bucket
 
-            free(tuples);
+static void placeTuples(Reln r, Tuple *tuples, Count ntuples)
+{
+    BatchItem *items = malloc(sizeof(BatchItem) * (ntuples+1));
+    Tuple *group = malloc(sizeof(Tuple) * (ntuples+1));
+    assert(items != NULL && group != NULL);
+    for (Count i = 0; i < ntuples; i++) {
+        items[i].bucket = bucketOf(r, tupleHash(r, tuples[i]));
+        items[i].pos = i;
+    }
+    qsort(items, ntuples, sizeof(BatchItem), cmpBatchItem);
+    Count i = 0;
+    while (i < ntuples) {
+        PageID b = items[i].bucket;
+        Count ng = 0;
+        for (; i < ntuples && items[i].bucket == b; i++)
+            group[ng++] = tuples[items[i].pos];
+        insertTuplesIntoPageChain(r, b, group, ng);
+    }
+    free(items);
+    free(group);
+}
+
+// split the bucket (or, with partial expansions, the group of
+//   buckets) at the split pointer
+// caller must hold the split latch exclusively
+// a new bucket is added at the end of the data file; all tuples in
+//   the old bucket(s) and their overflow chains are collected, the
+//   pages are emptied, the split pointer advances, and the tuples are
+//   redistributed using the new addressing
+
+static void splitBucket(Reln r)
+{
+    PageID old[3];
+    Count nold = 0;
+    if (r->flags & RELN_PARTIAL) {
+        Count N = ngroups(r);
+        Count size = groupSize(r, r->sp);
+        for (Count i = 0; i < size; i++) old[nold++] = r->sp + i*N;
+    }
+    else
+        old[nold++] = r->sp;
+
+    // Creating a new bucket (sp + 2^d for classic linear hashing)
+    PageID newPageId = r->npages;
+    Page newPageObj = newPage();
+    r->npages++;
+    relPutPage(r, r->data, newPageId, newPageObj);
+    if (r->bloom != NULL) bloomGrow(r->bloom, r->npages);
 
+    // Collect all the tuples
+    Tuple *tuples = NULL;
+    Count ntuples = 0, size = 0;
+    for (Count i = 0; i < nold; i++)
+        takeBucket(r, old[i], &tuples, &ntuples, &size);
 
-            r->sp++;
-            if (r->sp == (1 << r->depth)) {
+    r->sp++;
+    r->version++;
+    if (r->flags & RELN_PARTIAL) {
+        if (r->sp == ngroups(r)) {
+            r->sp = 0;
+            if (r->phase == 0)
+                r->phase = 1;
+            else {
+                r->phase = 0;
                 r->depth++;
-                r->sp = 0;
             }
         }
     }
+    else if (r->sp == (1 << r->depth)) {
+        r->depth++;
+        r->sp = 0;
+    }
+
+    // Reallocate all tuples
+    placeTuples(r, tuples, ntuples);
+    for (Count i = 0; i < ntuples; i++) free(tuples[i]);
+    free(tuples);
+}
+
+// insert a new tuple into a relation
+// returns index of bucket where inserted
+// - index always refers to a primary data page
+// - the actual insertion page may be either a data page or an overflow page
+// returns NO_PAGE if insert fails completely
+// safe to call from several threads on the same Reln
+
+PageID addToRelation(Reln r, Tuple t)
+{
+    PageID p;
+    addBatchToRelation(r, &t, 1, &p);
     return p;
 }
 
+// insert a batch of n tuples into a relation
+// tuples are grouped by target bucket and each group is applied
+//   with one traversal of the bucket's page chain
+// the batch is placed in chunks of up to BATCHCHUNK tuples; splits
+//   that become due within a chunk are run after it, so a split can
+//   come up to a chunk later than with addToRelation() (the file has
+//   the same number of buckets once the batch is in)
+// if pids is non-NULL, pids[i] is set to the bucket for ts[i]
+//   (NO_PAGE if that tuple could not be inserted)
+// returns OK if every tuple was inserted, ~OK otherwise
+// concurrency: a chunk holds the split latch shared, and each group
+//   holds its bucket latch, so different buckets are filled in
+//   parallel; due splits are run afterwards with the latch exclusive
+// durability: the whole batch is committed to the log before return
+
+Status addBatchToRelation(Reln r, Tuple *ts, Count n, PageID *pids)
+{
+    Status status = OK;
+    BatchItem *items = malloc(sizeof(BatchItem) * (n+1));
+    Tuple *group = malloc(sizeof(Tuple) * (n+1));
+    assert(items != NULL && group != NULL);
+
+    Count done = 0, nsplits = 0;
+    while (done < n) {
+        latchShared(&r->splitLatch);
+        Count chunk = (n - done > BATCHCHUNK) ? BATCHCHUNK : n - done;
+
+        // bucket addresses are fixed until the next split
+        for (Count i = 0; i < chunk; i++) {
+            items[i].bucket = bucketOf(r, tupleHash(r, ts[done+i]));
+            items[i].pos = done+i;
+        }
+        qsort(items, chunk, sizeof(BatchItem), cmpBatchItem);
+
+        Count i = 0;
+        while (i < chunk) {
+            PageID b = items[i].bucket;
+            Count ng = 0, j;
+            for (j = i; j < chunk && items[j].bucket == b; j++)
+                group[ng++] = ts[items[j].pos];
+            pthread_mutex_t *latch = &r->bucketLatch[b % NLATCHES];
+            pthread_mutex_lock(latch);
+            Count placed = insertTuplesIntoPageChain(r, b, group, ng);
+            pthread_mutex_unlock(latch);
+            nsplits += countInserted(r, placed);
+            for (j = i; j < i+ng; j++) {
+                if (pids != NULL) pids[items[j].pos] = b;
+            }
+            if (placed < ng) {
+                // leftovers are at the front of group[]
+                status = ~OK;
+                for (Count k = 0; k < ng-placed; k++) {
+                    for (j = i; j < i+ng; j++) {
+                        if (ts[items[j].pos] == group[k] && pids != NULL)
+                            pids[items[j].pos] = NO_PAGE;
+                    }
+                }
+            }
+            i += ng;
+        }
+        unlatchShared(&r->splitLatch);
+        done += chunk;
+        for (; nsplits > 0; nsplits--) {
+            latchExclusive(&r->splitLatch);
+            splitBucket(r);
+            unlatchExclusive(&r->splitLatch);
+        }
+    }
+    free(items);
+    free(group);
+    // batch is durable by the time we return
+    if (r->wal != NULL) commitInserts(r);
+    return status;
+}
+
+// could bucket b hold a tuple whose attribute attr is val (len bytes)?
+// TRUE unless the relation has Bloom filters that rule it out
+
+Bool bucketMayContain(Reln r, PageID b, Count attr, char *val, Count len)
+{
+    if (r->bloom == NULL) return TRUE;
+    return bloomMayContain(r->bloom, b, attr, val, len);
+}
+
+// locations of the tuples whose attribute attr is val (len bytes),
+//   or (if prefix) starts with val, from the secondary index on attr
+// *locs is set to a malloc'd array of *n locations, in scan order
+// returns FALSE if attr has no usable index (prefixes need an
+//   ordered index)
+
+Bool lookupIndex(Reln r, Count attr, char *val, Count len, Bool prefix, IndexLoc **locs, Count *n)
+{
+    if (r->hindex == NULL || !hindexHas(r->hindex, attr)) return FALSE;
+    if (prefix && !hindexOrdered(r->hindex, attr)) return FALSE;
+    *n = hindexLookup(r->hindex, attr, val, len, prefix, locs);
+    return TRUE;
+}
+
+// locations of the tuples whose attribute attr could match pattern
+//   (a query value with '%'s), from the trigram index on attr
+// *locs is set to a malloc'd array of *n locations, in scan order
+// returns FALSE if attr has no trigram index, or pattern has no
+//   literal part long enough to hold a trigram
+
+Bool lookupTrigrams(Reln r, Count attr, char *pattern, IndexLoc **locs, Count *n)
+{
+    if (r->hindex == NULL || !hindexTrigrams(r->hindex, attr)) return FALSE;
+    return hindexLookupTrigrams(r->hindex, attr, pattern, locs, n);
+}
+
+// the tuples whose attribute attr is val (len bytes), as a set of
+//   positions from the bitmap index on attr (see bitmap.c)
+// NULL if attr has no usable bitmap index
+
+Bitmap lookupBitmap(Reln r, Count attr, char *val, Count len)
+{
+    if (r->bmap == NULL || !bmapHas(r->bmap, attr)) return NULL;
+    return bmapLookup(r->bmap, attr, val, len);
+}
+
+// locations of the tuples in bm (from lookupBitmap()), in scan order
+// *locs is set to a malloc'd array; returns the number of locations
+
+Count bitmapLocations(Reln r, Bitmap bm, IndexLoc **locs)
+{
+    return bmapLocations(r->bmap, bm, locs);
+}
+
 // external interfaces for Reln data
 
 FILE *dataFile(Reln r) { return r->data; }
@@ -295,8 +1046,14 @@ FILE *ovflowFile(Reln r) { return r->ovflow; }
 Count nattrs(Reln r) { return r->nattrs; }
 Count npages(Reln r) { return r->npages; }
 Count ntuples(Reln r) { return r->ntups; }
+Count novflow(Reln r) { return r->novflow; }
 Count depth(Reln r)  { return r->depth; }
 Count splitp(Reln r) { return r->sp; }
+Count flags(Reln r)  { return r->flags; }
+Count types(Reln r)  { return r->types; }
+Count attrType(Reln r, Count attr) { return RELN_TYPE(r->types, attr); }
+Count version(Reln r) { return r->version; }
+Count stamp(Reln r)   { return r->stamp; }
 ChVecItem *chvec(Reln r)  { return r->cv; }
 
 
@@ -305,8 +1062,10 @@ ChVecItem *chvec(Reln r)  { return r->cv; }
 void relationStats(Reln r)
 {
 	printf("Global Info:\n");
-	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d\n",
+	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d",
 	       r->nattrs, r->npages, r->ntups, r->depth, r->sp);
+	if (r->flags & RELN_PARTIAL) printf("  phase:%d", r->phase);
+	putchar('\n');
 	printf("Choice vector\n");
 	printChVec(r->cv);
 	printf("Bucket Info:\n");
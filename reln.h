@@ -8,22 +8,59 @@
 
 typedef struct RelnRep *Reln;
 
+// options for newRelation()
+#define RELN_PARTIAL 0x1  // linear hashing with partial expansions
+#define RELN_BLOOM   0x2  // per-bucket Bloom filters on attribute values
+// indexes on attribute a (0..9), one bit per attribute for each kind
+#define RELN_INDEX(a)   (0x4u << (a))       // secondary hash index
+#define RELN_ORDER(a)   (0x1000u << (a))    // ordered (B+-tree) index
+#define RELN_TRIGRAM(a) (0x400000u << (a))  // trigram index, for '%x%' patterns
+#define RELN_INDEXED(flags)  (((flags) >> 2) & 0x3ff)   // attributes with RELN_INDEX
+#define RELN_ORDERED(flags)  (((flags) >> 12) & 0x3ff)  // attributes with RELN_ORDER
+#define RELN_TRIGRAMS(flags) (((flags) >> 22) & 0x3ff)  // attributes with RELN_TRIGRAM
+
+// attribute types for newRelation(), two bits per attribute
+#define TYPE_STRING 0  // text (the default)
+#define TYPE_INT    1  // 32-bit signed integer, stored in binary
+#define TYPE_FLOAT  2  // double, stored in binary
+#define RELN_TYPE(types,a) (((types) >> (2*(a))) & 0x3)
+
 #include "defs.h"
 #include "tuple.h"
 #include "page.h"
 #include "chvec.h"
+#include "bits.h"
+#include "hashidx.h"
+#include "bitmap.h"
 
-Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv);
+Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv, Count flags, Count bitmaps, Count types);
 Reln openRelation(char *name, char *mode);
 void closeRelation(Reln r);
+Bool refreshRelation(Reln r);
+Bool relationChanged(Reln r);
 Bool existsRelation(char *name);
+PageID bucketOf(Reln r, Bits h);
+Bool bucketMayContain(Reln r, PageID b, Count attr, char *val, Count len);
+Bool lookupIndex(Reln r, Count attr, char *val, Count len, Bool prefix, IndexLoc **locs, Count *n);
+Bool lookupTrigrams(Reln r, Count attr, char *pattern, IndexLoc **locs, Count *n);
+Bitmap lookupBitmap(Reln r, Count attr, char *val, Count len);
+Count bitmapLocations(Reln r, Bitmap bm, IndexLoc **locs);
+Count groupSize(Reln r, PageID g);
+Count groupPosition(Bits h, Count d, Count size);
 PageID addToRelation(Reln r, Tuple t);
+Status addBatchToRelation(Reln r, Tuple *ts, Count n, PageID *pids);
 FILE *dataFile(Reln r);
 FILE *ovflowFile(Reln r);
 Count nattrs(Reln r);
 Count npages(Reln r);
+Count novflow(Reln r);
 Count depth(Reln r);
 Count splitp(Reln r);
+Count flags(Reln r);
+Count types(Reln r);
+Count attrType(Reln r, Count attr);
+Count version(Reln r);
+Count stamp(Reln r);
 ChVecItem *chvec(Reln r);
 void relationStats(Reln r);
 
@@ -0,0 +1,150 @@
+// scan.c ... page-scan kernel
+// part of Multi-attribute Linear-hashed Files
+// Find all tuple and field boundaries in a page in one pass
+
+#include <pthread.h>
+#include "defs.h"
+#include "scan.h"
+#include "page.h"
+
+// Tuples in a page are '\0'-terminated strings of ','-separated
+// values, packed one after another. Rather than walk them with
+// strlen() and then strchr(',') per field, a page is scanned once
+// for every '\0' and ',' byte, giving a PageIndex from which any
+// tuple or field can be located directly.
+// On x86 the scan compares 16 (SSE2) or 32 (AVX2) bytes at a time
+// and turns the comparison into a bit mask, one bit per byte; the
+// AVX2 version is chosen at runtime if the CPU supports it. Other
+// CPUs use the scalar loop.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// append the offset of each set bit in mask (relative to base)
+
+static Count addMaskBits(unsigned int mask, Count base, DelimPos *delim, Count n)
+{
+	while (mask != 0) {
+		delim[n++] = base + __builtin_ctz(mask);
+		mask &= mask - 1;
+	}
+	return n;
+}
+
+static Count scanScalar(char *buf, Count len, DelimPos *delim, Count from, Count n)
+{
+	for (Count i = from; i < len; i++) {
+		if (buf[i] == '\0' || buf[i] == ',') delim[n++] = i;
+	}
+	return n;
+}
+
+#ifdef SCAN_X86
+
+#if defined(__SSE2__)
+static Count scanSSE2(char *buf, Count len, DelimPos *delim)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i comma = _mm_set1_epi8(',');
+	Count i = 0, n = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i *)(buf + i));
+		__m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, zero), _mm_cmpeq_epi8(v, comma));
+		n = addMaskBits(_mm_movemask_epi8(hit), i, delim, n);
+	}
+	return scanScalar(buf, len, delim, i, n);
+}
+#endif
+
+__attribute__((target("avx2")))
+static Count scanAVX2(char *buf, Count len, DelimPos *delim)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i comma = _mm256_set1_epi8(',');
+	Count i = 0, n = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(buf + i));
+		__m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, zero), _mm256_cmpeq_epi8(v, comma));
+		n = addMaskBits((unsigned int)_mm256_movemask_epi8(hit), i, delim, n);
+	}
+	return scanScalar(buf, len, delim, i, n);
+}
+
+#endif
+
+static Count scanPlain(char *buf, Count len, DelimPos *delim)
+{
+	return scanScalar(buf, len, delim, 0, 0);
+}
+
+// choose the best available kernel on first use
+// scans run in several threads at once (parallel selections, insert -t),
+//   so the choice is made once, under pthread_once, and published with
+//   a single store
+
+static Count (*scanKernel)(char *, Count, DelimPos *) = NULL;
+static pthread_once_t kernelChosen = PTHREAD_ONCE_INIT;
+
+static void chooseKernel(void)
+{
+	Count (*kernel)(char *, Count, DelimPos *) = scanPlain;
+#ifdef SCAN_X86
+#if defined(__SSE2__)
+	kernel = scanSSE2;
+#endif
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) kernel = scanAVX2;
+#endif
+	scanKernel = kernel;
+}
+
+// find the offsets of all ',' and '\0' bytes in buf[0..len-1]
+// delim[] must have room for len entries; returns # found
+
+Count scanDelims(char *buf, Count len, DelimPos *delim)
+{
+	pthread_once(&kernelChosen, chooseKernel);
+	return scanKernel(buf, len, delim);
+}
+
+// build the index for all tuples in a page
+
+void indexPage(Page p, PageIndex *ix)
+{
+	ix->ndelims = scanDelims(pageData(p), pageUsed(p), ix->delim);
+	char *data = pageData(p);
+	Count n = 0;
+	for (Count i = 0; i < ix->ndelims; i++) {
+		if (data[ix->delim[i]] == '\0') ix->tupEnd[n++] = i;
+	}
+	ix->ntuples = n;
+}
+
+// locate tuple i in an indexed page; sets *len to its length
+
+char *indexedTuple(Page p, PageIndex *ix, Count i, Count *len)
+{
+	Count start = (i == 0) ? 0 : ix->delim[ix->tupEnd[i-1]] + 1;
+	*len = ix->delim[ix->tupEnd[i]] - start;
+	return pageData(p) + start;
+}
+
+// locate up to max fields of tuple i in an indexed page
+// field j is start[j] .. start[j]+len[j]-1; returns # of fields
+
+Count indexedFields(Page p, PageIndex *ix, Count i, char **start, Count *len, Count max)
+{
+	char *data = pageData(p);
+	Count first = (i == 0) ? 0 : ix->tupEnd[i-1] + 1;
+	Count from = (i == 0) ? 0 : ix->delim[first-1] + 1;
+	Count n = 0;
+	for (Count d = first; d <= ix->tupEnd[i] && n < max; d++) {
+		start[n] = data + from;
+		len[n] = ix->delim[d] - from;
+		from = ix->delim[d] + 1;
+		n++;
+	}
+	return n;
+}
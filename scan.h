@@ -0,0 +1,28 @@
+// scan.h ... interface to the page-scan kernel
+// part of Multi-attribute Linear-hashed Files
+// See scan.c for details of PageIndex type and functions
+
+#ifndef SCAN_H
+#define SCAN_H 1
+
+#include "defs.h"
+#include "page.h"
+
+typedef unsigned short DelimPos;
+
+// positions of every tuple and field boundary in a page
+// - delim[] holds the offset of each ',' and '\0' in the page data
+// - tupEnd[i] is the index in delim[] of the '\0' ending tuple i
+typedef struct {
+	Count    ntuples;            // tuples indexed
+	Count    ndelims;            // entries in delim[]
+	DelimPos delim[PAGESIZE];    // offsets of ',' and '\0'
+	DelimPos tupEnd[PAGESIZE/2]; // per tuple, index of its '\0' in delim[]
+} PageIndex;
+
+Count scanDelims(char *buf, Count len, DelimPos *delim);
+void indexPage(Page p, PageIndex *ix);
+char *indexedTuple(Page p, PageIndex *ix, Count i, Count *len);
+Count indexedFields(Page p, PageIndex *ix, Count i, char **start, Count *len, Count max);
+
+#endif
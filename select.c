@@ -10,10 +10,85 @@
 #include "tuple.h"
 #include "bits.h"
 #include "hash.h"
+#include "scan.h"
+#include <pthread.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+// --------------------------------------------------------------------------
+// compiled form of a query value (see compileMatcher)
+typedef enum {
+    MATCH_ANY, MATCH_EXACT, MATCH_PREFIX, MATCH_SUFFIX, MATCH_CONTAINS, MATCH_GENERAL,
+    MATCH_RANGE, MATCH_IN
+} MatchKind;
+
+typedef struct Matcher {
+    MatchKind kind;     // which matcher
+    int    nsegs;       // number of literal segments (between '%'s)
+    char **segs;        // literal segments
+    int   *seglens;     // lengths of segments
+    Bool   anchorStart; // GENERAL: first segment must start the value
+    Bool   anchorEnd;   // GENERAL: last segment must end the value
+    Count  type;        // attribute type (TYPE_*)
+    Bool   text;        // numeric value is matched as text (patterns)
+    char  *lo, *hi;     // RANGE: bounds in stored form (NULL if none)
+    int    lolen, hilen;
+    Bool   loStrict, hiStrict; // RANGE: bound itself excluded ('>', '<')
+    struct Matcher *alts; // IN: one matcher per alternative
+    int    nalts;
+} Matcher;
+
+// state for enumerating candidate buckets (see startCandidates)
+typedef struct {
+    Reln    rel;           // Relation being scanned
+    Bits    known;         // Hash bits from known attributes
+    Bits    unknown;       // Unknown (wildcard) bits
+    Count   depth;         // Depth of file
+    PageID  sp;            // Split pointer
+    Bool    partial;       // File grown by partial expansions
+    Count   ngroups;       // Partial expansions: number of groups
+    Bool    reach[5][4];   // Partial expansions: reachable positions by group size
+    Bits    mask;          // Address bits to enumerate
+    Bits    base;          // Fixed address bits
+    Bits    sub;           // Current subset of mask
+    Count   pos;           // Partial expansions: current position in group
+    Bool    done;          // All candidates produced
+    PageID *list;          // IN-lists: all candidates, ascending (or NULL)
+    Count   nlist;         // IN-lists: number of candidates
+    Count   next;          // IN-lists: next candidate in list
+} CandIter;
+
+#define SEQCHUNK   64  // pages read at once by a sequential scan
+#define SEQFACTOR  2   // pages read in file order cost 1/SEQFACTOR of chain hops
+#define MAXCOMBOS  256 // most combinations of IN-list values enumerated
+#define MAXWORKERS 64  // most scan threads for one selection
+#define QUEUESLOTS 64  // most bucket results waiting to be returned
+
+// matching tuples from one bucket chain, in chain order
+typedef struct {
+    Tuple  *tuples;        // copies of matching tuples
+    Count   n;             // number of tuples
+    Bool    ready;         // slot holds a result not yet returned
+} ResultBatch;
+
+// worker threads and result queue for a parallel selection
+typedef struct {
+    pthread_t workers[MAXWORKERS];
+    Count   nworkers;      // number of worker threads
+    Bool    ordered;       // return results in bucket order
+    pthread_mutex_t lock;  // guards the fields below and the CandIter
+    pthread_cond_t space;  // a queue slot has been freed
+    pthread_cond_t results;// a result has been queued
+    Count   nextSeq;       // number of buckets handed out to workers
+    Count   head;          // number of results returned; next is slot head%QUEUESLOTS
+    Count   nqueued;       // unordered: results waiting in the queue
+    Count   running;       // workers still scanning
+    Bool    stop;          // selection closed before all results were read
+    ResultBatch slots[QUEUESLOTS];
+} ScanPool;
+
 // --------------------------------------------------------------------------
 struct SelectionRep {
     Reln    rel;           // Relation info
@@ -21,172 +96,841 @@ struct SelectionRep {
     Bits    unknown;       // Unknown (wildcard) bits
     Page    curpage;       // Current page in scan
     int     is_ovflow;     // 0: main file, 1: ovflow file
-    Offset  curtupOffset;  // Offset of current tuple within page data buffer
     Offset  curtupIndex;   // Index of current tuple in the current page
+    PageIndex index;       // Tuple/field boundaries in the current page
     PageID  curPageId;     // Current main page ID
     PageID  curScanPageId; // Current page ID being scanned
     char   *queryString;   // Original query string
     char  **queryValues;   // Array of query attribute values
+    Matcher *matchers;     // Compiled form of each query value
+    int     lastMatcher;   // Index of last matcher that isn't MATCH_ANY
     Count   nattrs;        // Number of attributes
 
-    PageID *candidates;    // Array of candidate page IDs computed from known/unknown bits
-    Count   ncandidates;   // Number of candidate pages
-    Count   currCandidate; // Index of the current candidate page being scanned
+    CandIter cands;        // Enumerates candidate pages from known/unknown bits
+    Count   ncombos;       // IN-lists: sets of hash bits whose buckets are joined
+    IndexLoc *locs;        // Index: where tuples that may match are (or NULL)
+    Count   nlocs;         // Index: number of locations
+    Count   curloc;        // Index: next location to visit
+    char   *path;          // Index: which index gave locs (for explainSelection)
+    int     pathAttr;      // Index: ... and on which attribute (-1: several)
+    Count   pathPages;     // Index: different pages among locs
+    Bitmap  bitmap;        // Bitmaps: tuples with the exact values (or NULL)
+    Bool    counted;       // Bitmaps: ... and with every query value
+    Bool    sequential;    // Sequential: read whole files rather than chains
+    Byte   *chunk;         // Sequential: SEQCHUNK pages, read at once
+    Count   nchunk;        // Sequential: pages in chunk
+    Count   chunkPage;     // Sequential: next page of chunk to scan
+    PageID  nextRead;      // Sequential: next page of the file to read
+    ScanPool *pool;        // Worker threads for a parallel selection (or NULL)
+    ResultBatch out;       // Parallel: result currently being returned
+    Count   nout;          // Parallel: tuples of out already returned
+    Tuple   borrowed;      // Parallel: tuple last lent by getNextTupleSpan()
 };
 
 // --------------------------------------------------------------------------
-// Implement pattern matching '?' and '%'
-
-// Params:
-//    tupleValue - The attribute value from the tuple
-//    queryValue - The query pattern to match against
-// Returns:
-//    TRUE if the tupleValue matches the queryValue pattern, FALSE otherwise
-Bool matchPattern(char *tupleValue, char *queryValue) {
-    // Case 1: "?" wildcard matches any tuple value
+// Pattern matching '?' and '%'
+// Each query value is compiled once, in startSelection(), into the
+// cheapest matcher that implements it:
+//   "?", "%", "%%"...    -> MATCH_ANY       always true
+//   "abc"                -> MATCH_EXACT     length check + memcmp
+//   "abc%"               -> MATCH_PREFIX    memcmp at start
+//   "%abc"               -> MATCH_SUFFIX    memcmp at end
+//   "%abc%"              -> MATCH_CONTAINS  substring search
+//   "a%b%c", "%a%b" ...  -> MATCH_GENERAL   anchored first/last segments,
+//                                           middle segments found leftmost
+// '%' matches zero or more characters; leftmost matching of each middle
+// segment is enough, since '%' on either side absorbs any gap.
+// Matchers work on (value, length) spans inside the tuple, so tuples
+// don't need to be split into separate strings.
+// Values of int and float attributes are stored in binary (see tuple.c),
+// so they are matched in that form: an exact number is converted,
+// and compared byte for byte. These attributes also take ranges
+//   "<n", "<=n", ">n", ">=n"  -> MATCH_RANGE     one bound
+//   "m..n"                    -> MATCH_RANGE     between m and n inclusive
+// whose bounds are compared with memcmp, as the stored form keeps the
+// order of the numbers. Patterns with '%' are matched against the
+// number's text.
+// Any query value can also list alternatives:
+//   "a|b|c"                   -> MATCH_IN        one matcher per alternative
+// which matches if any alternative does; an alternative of "?" makes
+// it MATCH_ANY.
+
+// compile a range on a numeric attribute (see above) into m
+// returns FALSE if it has a bound that isn't a number
+
+static Bool compileRange(Matcher *m, char *queryValue)
+{
+    char *lo = NULL, *hi = NULL, *dots = strstr(queryValue, "..");
+    m->kind = MATCH_RANGE;
+    m->loStrict = m->hiStrict = FALSE;
+    if (queryValue[0] == '<') {
+        m->hiStrict = (queryValue[1] != '=');
+        hi = queryValue + (m->hiStrict ? 1 : 2);
+    }
+    else if (queryValue[0] == '>') {
+        m->loStrict = (queryValue[1] != '=');
+        lo = queryValue + (m->loStrict ? 1 : 2);
+    }
+    else {
+        lo = queryValue;
+        hi = dots + 2;
+    }
+    Count lolen = (lo == NULL) ? 0 : (lo == queryValue) ? dots - lo : strlen(lo);
+    Count hilen = (hi == NULL) ? 0 : strlen(hi);
+    // "..n" and "m.." leave a side open
+    if (lolen > 0) {
+        m->lo = malloc(MAXTUPLEN);
+        assert(m->lo != NULL);
+        if ((m->lolen = encodeValue(m->type, lo, lolen, m->lo)) < 0) return FALSE;
+    }
+    if (hilen > 0) {
+        m->hi = malloc(MAXTUPLEN);
+        assert(m->hi != NULL);
+        if ((m->hilen = encodeValue(m->type, hi, hilen, m->hi)) < 0) return FALSE;
+    }
+    return m->lo != NULL || m->hi != NULL;
+}
+
+static Bool compileMatcher(Matcher *m, char *queryValue, Count type);
+
+// compile the alternatives "a|b|c" (see above) into m
+
+static Bool compileAlternatives(Matcher *m, char *queryValue, Count type)
+{
+    Count n = 1;
+    for (char *c = queryValue; *c != '\0'; c++) {
+        if (*c == '|') n++;
+    }
+    m->kind = MATCH_IN;
+    m->alts = malloc(n * sizeof(Matcher));
+    assert(m->alts != NULL);
+    char *alt = copyString(queryValue), *c = alt;
+    Bool ok = TRUE;
+    for (;;) {
+        char *end = strchr(c, '|');
+        if (end != NULL) *end = '\0';
+        Matcher *a = &m->alts[m->nalts++];
+        if (!compileMatcher(a, c, type)) ok = FALSE;
+        if (a->kind == MATCH_ANY) m->kind = MATCH_ANY;
+        if (end == NULL) break;
+        c = end + 1;
+    }
+    free(alt);
+    return ok;
+}
+
+// compile a query value for an attribute of the given type into a matcher
+// returns FALSE if it isn't valid for the type
+
+static Bool compileMatcher(Matcher *m, char *queryValue, Count type)
+{
+    m->nsegs = 0;
+    m->segs = NULL;
+    m->seglens = NULL;
+    m->type = type;
+    m->text = FALSE;
+    m->lo = m->hi = NULL;
+    m->alts = NULL;
+    m->nalts = 0;
     if (strcmp(queryValue, "?") == 0) {
+        m->kind = MATCH_ANY;
         return TRUE;
     }
+    if (strchr(queryValue, '|') != NULL)
+        return compileAlternatives(m, queryValue, type);
+    if (type != TYPE_STRING) {
+        if (queryValue[0] == '<' || queryValue[0] == '>' || strstr(queryValue, "..") != NULL)
+            return compileRange(m, queryValue);
+        m->text = (strchr(queryValue, '%') != NULL);
+    }
 
-    // Case 2: Pattern matching with '%' wildcard
-    if (strchr(queryValue, '%') != NULL) {
-        char *pattern = queryValue;  // Pattern string with possible '%' wildcards
-        char *text = tupleValue;      // Text to match against the pattern
-        char *p, *t;                  // Pointers for traversing pattern and text
-        char *pTag = NULL, *tTag = NULL;  // Tags for backtracking when matching '%'
+    // split into literal segments, dropping empty ones
+    int n = strlen(queryValue);
+    m->segs = malloc((n/2+2) * sizeof(char *));
+    m->seglens = malloc((n/2+2) * sizeof(int));
+    assert(m->segs != NULL && m->seglens != NULL);
+    char *c = queryValue;
+    while (*c != '\0') {
+        char *end = strchr(c, '%');
+        int len = (end == NULL) ? (int)strlen(c) : (int)(end - c);
+        if (len > 0) {
+            char *seg = malloc(len + 1);
+            assert(seg != NULL);
+            memcpy(seg, c, len);
+            seg[len] = '\0';
+            m->segs[m->nsegs] = seg;
+            m->seglens[m->nsegs] = len;
+            m->nsegs++;
+        }
+        if (end == NULL) break;
+        c = end + 1;
+    }
+    Bool lead = (queryValue[0] == '%');
+    Bool trail = (n > 0 && queryValue[n-1] == '%');
+    m->anchorStart = !lead;
+    m->anchorEnd = !trail;
 
-        p = pattern;
-        t = text;
+    if (m->nsegs == 0)
+        m->kind = (n == 0) ? MATCH_EXACT : MATCH_ANY;
+    else if (!lead && !trail && m->nsegs == 1)
+        m->kind = MATCH_EXACT;
+    else if (m->nsegs > 1)
+        m->kind = MATCH_GENERAL;
+    else if (!lead)
+        m->kind = MATCH_PREFIX;
+    else if (!trail)
+        m->kind = MATCH_SUFFIX;
+    else
+        m->kind = MATCH_CONTAINS;
+    if (m->kind != MATCH_EXACT || m->text || type == TYPE_STRING) return TRUE;
 
-        while (*t) {
-            if (*p == '%') {
-                // Record the position of '%' for possible backtracking
-                pTag = p++;
-                tTag = t;
+    // an exact number is matched in its stored form
+    if (m->nsegs == 0) return FALSE;
+    char *seg = malloc(MAXTUPLEN);
+    assert(seg != NULL);
+    int len = encodeValue(type, m->segs[0], m->seglens[0], seg);
+    free(m->segs[0]);
+    m->segs[0] = seg;
+    m->seglens[0] = len;
+    return len >= 0;
+}
 
-                // Skip consecutive '%' characters
-                while (*p == '%') p++;
+static void freeMatcher(Matcher *m)
+{
+    for (int i = 0; i < m->nsegs; i++) free(m->segs[i]);
+    free(m->segs);
+    free(m->seglens);
+    free(m->lo);
+    free(m->hi);
+    for (int i = 0; i < m->nalts; i++) freeMatcher(&m->alts[i]);
+    free(m->alts);
+}
 
-                // If pattern ends after '%', match succeeds
-                if (*p == '\0') return TRUE;
-            }
-            else if (*p == *t) {
-                // Characters match, move both pointers forward
-                p++;
-                t++;
-            }
-            else if (pTag) {
-                // Mismatch after '%'; backtrack to try matching more characters
-                p = pTag + 1;
-                t = ++tTag;
-            }
-            else {
-                // No '%' wildcard available and characters don't match
-                return FALSE;
+// find needle (length nlen > 0) in hay (length hlen)
+// returns offset of leftmost occurrence, or -1 if none
+// memchr finds candidate first characters quickly
+
+static int findSpan(char *hay, int hlen, char *needle, int nlen)
+{
+    char *c = hay, *last = hay + hlen - nlen;
+    while (c <= last) {
+        c = memchr(c, needle[0], last - c + 1);
+        if (c == NULL) return -1;
+        if (memcmp(c+1, needle+1, nlen-1) == 0) return c - hay;
+        c++;
+    }
+    return -1;
+}
+
+// does the value (length len) match the compiled query value?
+
+static Bool runMatcher(Matcher *m, char *val, int len)
+{
+    char text[MAXTUPLEN];
+    if (m->text) {
+        len = valueText(m->type, val, len, text);
+        val = text;
+    }
+    int l0 = (m->nsegs > 0) ? m->seglens[0] : 0;
+    switch (m->kind) {
+    case MATCH_RANGE:
+        if (m->lo != NULL) {
+            int cmp = (len == m->lolen) ? memcmp(val, m->lo, len) : len - m->lolen;
+            if (cmp < 0 || (cmp == 0 && m->loStrict)) return FALSE;
+        }
+        if (m->hi != NULL) {
+            int cmp = (len == m->hilen) ? memcmp(val, m->hi, len) : len - m->hilen;
+            if (cmp > 0 || (cmp == 0 && m->hiStrict)) return FALSE;
+        }
+        return TRUE;
+    case MATCH_IN:
+        for (int i = 0; i < m->nalts; i++) {
+            if (runMatcher(&m->alts[i], val, len)) return TRUE;
+        }
+        return FALSE;
+    case MATCH_ANY:
+        return TRUE;
+    case MATCH_EXACT:
+        return len == l0 && (len == 0 || memcmp(val, m->segs[0], len) == 0);
+    case MATCH_PREFIX:
+        return len >= l0 && memcmp(val, m->segs[0], l0) == 0;
+    case MATCH_SUFFIX:
+        return len >= l0 && memcmp(val+len-l0, m->segs[0], l0) == 0;
+    case MATCH_CONTAINS:
+        return findSpan(val, len, m->segs[0], l0) >= 0;
+    case MATCH_GENERAL:
+        break;
+    }
+    int pos = 0, end = len;
+    int first = 0, last = m->nsegs;
+    if (m->anchorStart) {
+        if (len < l0 || memcmp(val, m->segs[0], l0) != 0) return FALSE;
+        pos = l0; first = 1;
+    }
+    if (m->anchorEnd) {
+        int ln = m->seglens[m->nsegs-1];
+        if (len - ln < pos || memcmp(val+len-ln, m->segs[m->nsegs-1], ln) != 0)
+            return FALSE;
+        end = len - ln; last = m->nsegs-1;
+    }
+    for (int i = first; i < last; i++) {
+        int at = findSpan(val+pos, end-pos, m->segs[i], m->seglens[i]);
+        if (at < 0) return FALSE;
+        pos += at + m->seglens[i];
+    }
+    return TRUE;
+}
+
+// --------------------------------------------------------------------------
+// checks whether tuple i of page p (indexed in ix) matches the query
+// field boundaries come from the page index, so no scanning is needed
+static Bool matchIndexed(Selection s, Page p, PageIndex *ix, Count i)
+{
+    if (s->lastMatcher < 0) return TRUE;
+    char *start[s->nattrs];
+    Count len[s->nattrs];
+    Count n = indexedFields(p, ix, i, start, len, s->lastMatcher+1);
+    for (int j = 0; j < n; j++) {
+        if (!runMatcher(&s->matchers[j], start[j], len[j])) return FALSE;
+    }
+    return TRUE;
+}
+
+// load a page into the scan and index its tuples
+static void loadPage(Selection s, FILE *f, PageID pid)
+{
+    s->curScanPageId = pid;
+    s->curtupIndex = 0;
+    s->curpage = getPage(f, pid);
+    indexPage(s->curpage, &s->index);
+}
+
+// --------------------------------------------------------------------------
+// Candidate buckets
+// Buckets are enumerated lazily, in ascending page order, with O(1)
+// state: the address bits that the query leaves open form a mask, and
+// successive subsets of the mask are produced by sub = (sub - mask) & mask
+// (which counts upwards through the mask's bits only). Each subset,
+// OR'd with the known address bits, gives a possible bucket address.
+//
+// classic linear hashing, depth d, split pointer sp:
+//   addresses have d+1 bits, and bit d is always enumerated
+//   - bit d = 0, low d bits >= sp: bucket is the d-bit address
+//   - bit d = 0, low d bits <  sp: bucket has been split; valid if
+//     the query allows bit d = 0
+//   - bit d = 1: bucket 2^d+low exists only if low < sp, and is
+//     valid if the query allows bit d = 1
+// partial expansions, depth d, N = 2^(d-1) groups:
+//   for each position pos = 0..3 in turn, groups g are enumerated from
+//   the low d-1 bits; g + pos*N is a candidate if group g has a bucket
+//   at pos, and some setting of the unknown bits among bits d-1..d+4
+//   (which decide positions) puts a tuple there
+// IN-lists of exact values give one set of known bits per combination
+// of alternatives; their candidates are merged into one sorted list,
+// which is then handed out instead (see unionCandidates)
+
+// is hash bit i allowed to have value v by the query?
+static Bool bitAllowed(CandIter *it, int i, int v)
+{
+    return bitIsSet(it->unknown, i) || bitIsSet(it->known, i) == v;
+}
+
+// set up enumeration of candidate buckets for known/unknown hash bits
+static void startCandidates(CandIter *it, Reln r, Bits known, Bits unknown)
+{
+    it->rel = r;
+    it->known = known;
+    it->unknown = unknown;
+    it->depth = depth(r);
+    it->sp = splitp(r);
+    it->partial = (flags(r) & RELN_PARTIAL) != 0;
+    it->sub = 0;
+    it->done = FALSE;
+    it->pos = 0;
+    it->list = NULL;
+    it->nlist = it->next = 0;
+    if (it->partial) {
+        Count d = it->depth;
+        it->ngroups = 1 << (d-1);
+        it->mask = unknown & (it->ngroups-1);
+        it->base = known & (it->ngroups-1) & ~it->mask;
+        // positions reachable in groups of 2, 3 and 4 buckets
+        memset(it->reach, 0, sizeof(it->reach));
+        Bits m = 0x3f << (d-1);
+        for (Bits x = 0; x < 64; x++) {
+            Bits h = x << (d-1);
+            if ((h & m & ~unknown) != (known & m & ~unknown)) continue;
+            for (Count size = 2; size <= 4; size++) {
+                it->reach[size][groupPosition(h, d, size)] = TRUE;
             }
         }
+    } else {
+        Bits low = (1u << it->depth) - 1;
+        it->mask = (unknown & low) | (1u << it->depth);
+        it->base = known & low & ~unknown;
+    }
+}
 
-        // After text is fully matched, check if the rest of the pattern is only '%'
-        while (*p == '%') p++;
+// advance to the next subset of the mask; FALSE when all have been seen
+static Bool nextSubset(CandIter *it)
+{
+    it->sub = (it->sub - it->mask) & it->mask;
+    return it->sub != 0;
+}
 
-        // If pattern is fully consumed, match succeeds
-        if (*p == '\0') {
-            return TRUE;
+// produce the next candidate bucket; FALSE when there are no more
+static Bool nextCandidate(CandIter *it, PageID *pid)
+{
+    if (it->list != NULL) {
+        if (it->next == it->nlist) return FALSE;
+        *pid = it->list[it->next++];
+        return TRUE;
+    }
+    while (!it->done) {
+        Bits v = it->base | it->sub;
+        Bool ok;
+        PageID b;
+        if (it->partial) {
+            Count size = groupSize(it->rel, v);
+            ok = it->pos < size && it->reach[size][it->pos];
+            b = v + it->pos * it->ngroups;
+            if (!nextSubset(it)) {
+                if (++it->pos == 4) it->done = TRUE;
+            }
         } else {
-            return FALSE;
+            Count d = it->depth;
+            Bits low = v & ((1u << d) - 1);
+            if (!bitIsSet(v, d))
+                ok = (low >= it->sp) || bitAllowed(it, d, 0);
+            else
+                ok = (low < it->sp) && bitAllowed(it, d, 1);
+            b = v;
+            if (!nextSubset(it)) it->done = TRUE;
+        }
+        if (ok) {
+            *pid = b;
+            return TRUE;
         }
     }
+    return FALSE;
+}
 
-    // Case 3: Exact match (no wildcard)
-    if (strcmp(tupleValue, queryValue) == 0) {
-        return TRUE;
-    } else {
-        return FALSE;
+// is m an IN-list of exact values (which give hash bits)?
+static Bool exactAlts(Matcher *m)
+{
+    if (m->kind != MATCH_IN) return FALSE;
+    for (int i = 0; i < m->nalts; i++) {
+        Matcher *a = &m->alts[i];
+        if (a->kind != MATCH_EXACT || a->text || a->nsegs != 1) return FALSE;
     }
+    return TRUE;
 }
 
-// --------------------------------------------------------------------------
-// checks whether the tuple matches the query
-Bool matchTuple(Selection s, Tuple t) {
-    // checks whether the tuple matches the query
-    char **tupleValues = malloc(s->nattrs * sizeof(char *));
-    tupleVals(t, tupleValues);
-    Bool match = TRUE;
-    for (int i = 0; i < s->nattrs; i++) {
-        if (!matchPattern(tupleValues[i], s->queryValues[i])) {
-            match = FALSE;
-            break;
+static int cmpPageID(const void *a, const void *b)
+{
+    PageID x = *(const PageID *)a, y = *(const PageID *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+// make the candidates the union of the buckets for each combination
+//   of alternatives in the IN-lists; the attributes of IN-lists are
+//   left unknown if there are more than MAXCOMBOS combinations
+static void unionCandidates(Selection s)
+{
+    int in[s->nattrs];
+    Count nin = 0, ncombos = 1;
+    for (int a = 0; a < s->nattrs; a++) {
+        if (!exactAlts(&s->matchers[a])) continue;
+        in[nin++] = a;
+        ncombos *= s->matchers[a].nalts;
+        if (ncombos > MAXCOMBOS) return;
+    }
+    if (nin == 0) return;
+
+    ChVecItem *cv = chvec(s->rel);
+    int pick[s->nattrs];
+    PageID *list = NULL;
+    Count n = 0, size = 0;
+    for (Count c = 0; c < ncombos; c++) {
+        Count k = c;
+        for (Count j = 0; j < nin; j++) {
+            pick[in[j]] = k % s->matchers[in[j]].nalts;
+            k /= s->matchers[in[j]].nalts;
         }
+        Bits known = s->known, unknown = s->unknown;
+        for (int i = 0; i < MAXBITS; i++) {
+            Matcher *m = &s->matchers[cv[i].att];
+            if (!exactAlts(m)) continue;
+            Matcher *a = &m->alts[pick[cv[i].att]];
+            Bits h = hash_any((unsigned char *)a->segs[0], a->seglens[0]);
+            unknown = unsetBit(unknown, i);
+            if (bitIsSet(h, cv[i].bit)) known = setBit(known, i);
+        }
+        CandIter it;
+        startCandidates(&it, s->rel, known, unknown);
+        PageID b;
+        while (nextCandidate(&it, &b)) {
+            if (n == size) {
+                size = (size == 0) ? 64 : 2*size;
+                list = realloc(list, size * sizeof(PageID));
+                assert(list != NULL);
+            }
+            list[n++] = b;
+        }
+    }
+    qsort(list, n, sizeof(PageID), cmpPageID);
+    Count u = 0;
+    for (Count i = 0; i < n; i++) {
+        if (u == 0 || list[i] != list[u-1]) list[u++] = list[i];
     }
-    freeVals(tupleValues, s->nattrs);
-    return match;
+    s->cands.list = list;
+    s->cands.nlist = u;
+    s->cands.next = 0;
+    s->ncombos = ncombos;
+}
+
+// --------------------------------------------------------------------------
+// Access by secondary index
+// A query giving an exact value for an indexed attribute (or a prefix
+// 'abc%' for an attribute with an ordered index) can visit just the
+// pages holding tuples with such values, rather than every candidate
+// bucket chain; prefixes give no hash bits, so without an index they
+// mean scanning every bucket. Likewise, a trigram index narrows any
+// pattern with a literal part of 3 or more characters ('%abc%') down
+// to the tuples holding all of its trigrams, and only those are
+// matched against the pattern. Exact values on attributes with bitmap
+// indexes are taken together: their sets of tuple positions are
+// intersected, which gives one more list of locations, and also (when
+// they cover every query value) the number of results, unread.
+// An index is used when that means reading fewer pages: the candidate
+// buckets are counted, and each is assumed to have a chain of average
+// length.
+
+// average number of pages in a bucket chain
+// from the count of overflow pages in chains kept in .info, so free
+//   overflow pages (see reln.c) aren't counted
+static double chainLength(Reln r)
+{
+    return 1 + (double)novflow(r) / npages(r);
+}
+
+// pages in the overflow file, free ones included
+static Count ovflowFilePages(Reln r)
+{
+    struct stat st;
+    if (fstat(fileno(ovflowFile(r)), &st) != 0) return novflow(r);
+    return st.st_size / PAGESIZE;
 }
 
-// enumerating all possible combinations for the first numBits bits.
-// If a bit is unknown, it tries both 0 and 1; if known, it uses the fixed bit.
-// According to the given number of bits, all combinations of unknown bits are traversed to generate candidate bucket numbers
-PageID * genCandidates(Bits known, Bits unknown, int numBits, int *ncandidates)
+// number of pages read by scanning the candidate buckets, stopping
+//   once it reaches limit
+static Count scanPages(Selection s, Count limit)
 {
-    // recording unknown bit position
-    int unknownCount = 0;
-    int pos[32];
-    for (int i = 0; i < numBits; i++) {
-        if (bitIsSet(unknown, i)) {
-            pos[unknownCount++] = i;
+    CandIter it = s->cands;
+    double chain = chainLength(s->rel);
+    Count nbuckets = 0;
+    PageID b;
+    while (nbuckets*chain < limit && nextCandidate(&it, &b)) nbuckets++;
+    return nbuckets*chain;
+}
+
+// number of different pages among n locations (in scan order)
+static Count locPages(IndexLoc *locs, Count n)
+{
+    Count np = 0;
+    for (Count i = 0; i < n; i++) {
+        if (i == 0 || locs[i].bucket != locs[i-1].bucket || locs[i].page != locs[i-1].page)
+            np++;
+    }
+    return np;
+}
+
+// intersect the bitmap index sets for the exact query values (see
+//   bitmap.c), noting whether they account for every query value
+static void andBitmaps(Selection s)
+{
+    s->bitmap = NULL;
+    s->counted = TRUE;
+    for (int i = 0; i <= s->lastMatcher; i++) {
+        Matcher *m = &s->matchers[i];
+        Bitmap bm;
+        if (m->kind == MATCH_ANY) continue;
+        if (m->kind != MATCH_EXACT || m->nsegs != 1
+            || (bm = lookupBitmap(s->rel, i, m->segs[0], m->seglens[0])) == NULL) {
+            s->counted = FALSE;
+            continue;
+        }
+        if (s->bitmap != NULL) {
+            Bitmap and = bmapAnd(s->bitmap, bm);
+            bmapFree(s->bitmap);
+            bmapFree(bm);
+            bm = and;
         }
+        s->bitmap = bm;
     }
+    if (s->bitmap == NULL) s->counted = FALSE;
+}
 
-    int total = 1 << unknownCount;
-    PageID *results = malloc(total * sizeof(PageID));
-    assert(results != NULL);
+// same order as the locations from lookupIndex()
+static int cmpLoc(const void *a, const void *b)
+{
+    const IndexLoc *x = a, *y = b;
+    if (x->bucket != y->bucket) return (x->bucket < y->bucket) ? -1 : 1;
+    Count px = x->page + 1, py = y->page + 1;  // NO_PAGE comes first
+    if (px != py) return (px < py) ? -1 : 1;
+    return (x->slot < y->slot) ? -1 : (x->slot > y->slot);
+}
 
-    // go through each combination of unknown bits
-    for (int c = 0; c < total; c++) {
-        // use an array to store whether each bit is 0 or 1
-        int bits[numBits];
+// locations of the tuples with any of the exact values in IN-list m,
+//   from the index on attr (FALSE if there isn't one)
+static Bool lookupAlternatives(Reln r, Count attr, Matcher *m, IndexLoc **locs, Count *n)
+{
+    *locs = NULL;
+    *n = 0;
+    for (int i = 0; i < m->nalts; i++) {
+        IndexLoc *more;
+        Count k;
+        Matcher *a = &m->alts[i];
+        if (!lookupIndex(r, attr, a->segs[0], a->seglens[0], FALSE, &more, &k)) {
+            free(*locs);
+            return FALSE;
+        }
+        *locs = realloc(*locs, (*n + k + 1) * sizeof(IndexLoc));
+        assert(*locs != NULL);
+        memcpy(*locs + *n, more, k * sizeof(IndexLoc));
+        *n += k;
+        free(more);
+    }
+    // a tuple has one value, so no location is there twice
+    qsort(*locs, *n, sizeof(IndexLoc), cmpLoc);
+    return TRUE;
+}
 
-        // all bits are initialized and set bits using known
-        for (int i = 0; i < numBits; i++) {
-            bits[i] = bitIsSet(known, i) ? 1 : 0;
+// use the index that reads the fewest pages, if any beats scanning
+// the bitmap indexes count as one, as their sets are intersected
+static void chooseIndex(Selection s)
+{
+    s->locs = NULL;
+    s->nlocs = s->curloc = 0;
+    Count best = NO_PAGE;
+    s->path = NULL;
+    andBitmaps(s);
+    if (s->bitmap != NULL) {
+        s->nlocs = bitmapLocations(s->rel, s->bitmap, &s->locs);
+        best = locPages(s->locs, s->nlocs);
+        s->path = "bitmap indexes";
+        s->pathAttr = -1;
+    }
+    for (int i = 0; i <= s->lastMatcher; i++) {
+        Matcher *m = &s->matchers[i];
+        IndexLoc *locs;
+        Count n;
+        char *path;
+        // numbers are indexed in stored form, so only exact ones help
+        if (m->kind == MATCH_ANY || m->kind == MATCH_RANGE || m->text) continue;
+        Bool simple = (m->kind == MATCH_EXACT || m->kind == MATCH_PREFIX) && m->nsegs == 1;
+        Bool prefix = (m->kind == MATCH_PREFIX);
+        if (m->kind == MATCH_IN) {
+            if (!exactAlts(m) || !lookupAlternatives(s->rel, i, m, &locs, &n)) continue;
+            path = (flags(s->rel) & RELN_ORDER(i)) ? "ordered index" : "hash index";
+        }
+        else if (simple && lookupIndex(s->rel, i, m->segs[0], m->seglens[0], prefix, &locs, &n))
+            path = (flags(s->rel) & RELN_ORDER(i)) ? "ordered index" : "hash index";
+        else if (lookupTrigrams(s->rel, i, s->queryValues[i], &locs, &n))
+            path = "trigram index";
+        else
+            continue;
+        Count np = locPages(locs, n);
+        if (np < best) {
+            free(s->locs);
+            s->locs = locs;
+            s->nlocs = n;
+            best = np;
+            s->path = path;
+            s->pathAttr = i;
         }
+        else
+            free(locs);
+    }
+    s->pathPages = best;
+    if (s->locs != NULL && scanPages(s, best+1) <= best) {
+        free(s->locs);
+        s->locs = NULL;
+        s->nlocs = 0;
+    }
+}
 
-        // setting unknown bit with the combination number c
-        for (int i = 0; i < unknownCount; i++) {
-            int unknown_bit_value = (c & (1 << i)) ? 1 : 0;
-            bits[pos[i]] = unknown_bit_value;
+// next matching tuple found through the index (see getNextTupleSpan)
+static char *nextIndexedTuple(Selection s, Count *len)
+{
+    while (s->curloc < s->nlocs) {
+        IndexLoc *l = &s->locs[s->curloc++];
+        Bool ovflow = (l->page != NO_PAGE);
+        PageID pid = ovflow ? l->page : l->bucket;
+        if (s->curpage == NULL || s->is_ovflow != ovflow || s->curScanPageId != pid) {
+            free(s->curpage);
+            s->curPageId = l->bucket;
+            s->is_ovflow = ovflow;
+            loadPage(s, ovflow ? ovflowFile(s->rel) : dataFile(s->rel), pid);
         }
+        if (l->slot < s->index.ntuples && matchIndexed(s, s->curpage, &s->index, l->slot))
+            return indexedTuple(s->curpage, &s->index, l->slot, len);
+    }
+    free(s->curpage);
+    s->curpage = NULL;
+    return NULL;
+}
+
+// --------------------------------------------------------------------------
+// Sequential scan
+// When the candidate buckets cover much of the file (e.g. most query
+// values are '?'), following each chain means hopping between R.data
+// and R.ovflow. The selection then reads R.data front to back, SEQCHUNK
+// pages at a time, and then R.ovflow likewise, with no chain pointers
+// followed. Pages of buckets that aren't candidates are read too, but
+// none of their tuples can match, and so are free overflow pages,
+// which hold none. Each tuple is seen once because every non-empty
+// overflow page is in exactly one chain. The choice compares pages:
+// the whole files (free pages included) are read sequentially only if
+// that is at most SEQFACTOR times the pages in the candidates' chains
+// (estimated from the live overflow pages, see chainLength()). Results
+// come out in file order rather than bucket order, and Bloom filters
+// aren't consulted.
+
+// would reading the whole files cost less than following the chains?
+static Bool useSequential(Selection s)
+{
+    Count need = (npages(s->rel) + ovflowFilePages(s->rel) + SEQFACTOR-1) / SEQFACTOR;
+    return scanPages(s, need) >= need;
+}
 
-        // Assembled into a PageID value
-        PageID candidate = 0;
-        for (int i = 0; i < numBits; i++) {
-            if (bits[i]) {
-                candidate = setBit(candidate, i);
+// next matching tuple from a sequential scan (see getNextTupleSpan)
+// curpage points into chunk, rather than being allocated
+static char *nextSequentialTuple(Selection s, Count *len)
+{
+    if (s->chunk == NULL) {
+        s->chunk = malloc(SEQCHUNK * PAGESIZE);
+        assert(s->chunk != NULL);
+        s->nchunk = s->chunkPage = 0;
+        s->nextRead = 0;
+        s->is_ovflow = 0;
+    }
+    for (;;) {
+        while (s->curpage != NULL && s->curtupIndex < s->index.ntuples) {
+            Count i = s->curtupIndex++;
+            if (matchIndexed(s, s->curpage, &s->index, i))
+                return indexedTuple(s->curpage, &s->index, i, len);
+        }
+        s->curpage = NULL;
+        if (s->chunkPage == s->nchunk) {
+            // data pages past the last bucket (if any) aren't in use
+            Count n = SEQCHUNK;
+            if (!s->is_ovflow && s->nextRead + n > npages(s->rel))
+                n = npages(s->rel) - s->nextRead;
+            FILE *f = s->is_ovflow ? ovflowFile(s->rel) : dataFile(s->rel);
+            s->nchunk = (n == 0) ? 0 : readPages(f, s->nextRead, n, s->chunk);
+            s->chunkPage = 0;
+            s->nextRead += s->nchunk;
+            if (s->nchunk == 0) {
+                if (s->is_ovflow) return NULL;
+                s->is_ovflow = 1;
+                s->nextRead = 0;
+                continue;
             }
         }
+        s->curpage = (Page)(s->chunk + s->chunkPage * PAGESIZE);
+        s->curScanPageId = s->nextRead - s->nchunk + s->chunkPage++;
+        s->curtupIndex = 0;
+        indexPage(s->curpage, &s->index);
+    }
+}
+
+// number of tuples the selection will return, if the bitmap indexes
+//   give it without reading any pages (FALSE otherwise)
+Bool selectionCount(Selection s, Count *n)
+{
+    if (!s->counted) return FALSE;
+    *n = bmapCount(s->bitmap);
+    return TRUE;
+}
 
-        results[c] = candidate;
+// describe how the selection will be done, without doing it:
+//   the hash bits the query fixes (among those that address buckets,
+//   highest first; '?' if unknown), the candidate buckets and the pages
+//   scanning them should read, and the access path chosen
+// overflow pages are estimated from the average chain length
+void explainSelection(Selection s, FILE *f)
+{
+    Reln r = s->rel;
+    Count nbits = depth(r) + (splitp(r) > 0);
+    if (flags(r) & RELN_PARTIAL) nbits = depth(r) + 5;
+    if (nbits > MAXBITS) nbits = MAXBITS;
+    char bits[MAXBITS+1];
+    Count nknown = 0;
+    for (Count i = 0; i < nbits; i++) {
+        Count b = nbits-1-i;
+        bits[i] = bitIsSet(s->unknown, b) ? '?' : bitIsSet(s->known, b) ? '1' : '0';
+        if (bits[i] != '?') nknown++;
     }
+    bits[nbits] = '\0';
+
+    CandIter it = s->cands;
+    Count ncands = 0;
+    PageID b;
+    while (nextCandidate(&it, &b)) ncands++;
+    double chain = chainLength(r);
+    Count nchained = ncands*(chain-1) + 0.5;
 
-    *ncandidates = total;
-    return results;
+    fprintf(f, "Selection:         %s\n", s->queryString);
+    fprintf(f, "Hash bits:         %s (%d known, %d unknown)\n", bits, nknown, nbits-nknown);
+    if (s->cands.list != NULL)
+        fprintf(f, "IN-lists:          union of %d sets of hash bits\n", s->ncombos);
+    fprintf(f, "Candidate buckets: %d of %d\n", ncands, npages(r));
+    fprintf(f, "Bucket scan:       %d primary + %d overflow pages (%.2f per chain)\n",
+            ncands, nchained, chain);
+    Bool exact = FALSE;
+    for (int i = 0; i <= s->lastMatcher; i++) {
+        Matcher *m = &s->matchers[i];
+        if ((m->kind == MATCH_EXACT && m->nsegs == 1) || exactAlts(m)) exact = TRUE;
+    }
+    if ((flags(r) & RELN_BLOOM) && exact)
+        fprintf(f, "Bloom filters:     may skip candidate buckets\n");
+    if (s->sequential) {
+        fprintf(f, "Access path:       sequential scan, %d data + %d overflow pages\n",
+                npages(r), ovflowFilePages(r));
+    }
+    else if (s->locs == NULL)
+        fprintf(f, "Access path:       bucket scan\n");
+    else if (s->pathAttr < 0)
+        fprintf(f, "Access path:       %s, %d tuples on %d pages\n",
+                s->path, s->nlocs, s->pathPages);
+    else
+        fprintf(f, "Access path:       %s on attribute %d, %d tuples on %d pages\n",
+                s->path, s->pathAttr+1, s->nlocs, s->pathPages);
+    if (s->counted)
+        fprintf(f, "count(*):          %d, from bitmap indexes (no pages read)\n",
+                bmapCount(s->bitmap));
 }
 
 // --------------------------------------------------------------------------
 // a SelectionRep object is created from the query string and a list of candidate pages is generated
-Selection startSelection(Reln r, char *q)
+// with plan, the access path (index or sequential scan) is chosen too;
+//   batch selections (see startMultiSelection) only use the candidates
+static Selection newSelection(Reln r, char *q, Bool plan)
 {
     Selection new = malloc(sizeof(struct SelectionRep));
     assert(new != NULL);
     new->rel = r;             // relation being queried
     new->queryString = q;     // original query string
     new->is_ovflow = 0;       // not in overflow pages yet
-    new->curtupOffset = 0;    // tuple offset starts at 0
     new->curtupIndex = 0;     // tuple index starts at 0
     new->known = 0;           // known bits initialized to 0
     new->unknown = 0;         // unknown bits initialized to 0
     new->curPageId = 0;       // current page ID
     new->curScanPageId = 0;   // current scanning page ID
     new->nattrs = nattrs(r);  // number of attributes
+    new->cands.list = NULL;   // no IN-list candidates yet
+    new->ncombos = 1;
 
     // The query string is split by comma and parsed to obtain the query value for each attribute
     new->queryValues = malloc(new->nattrs * sizeof(char *));
@@ -211,27 +955,37 @@ Selection startSelection(Reln r, char *q)
     }
     free(temQueryStr);
 
-    // a temporary array vals for the hash, if the attribute is ? or %, it is marked with "*" to indicate unknown
-    char **vals = malloc(new->nattrs * sizeof(char *));
+    // each query value is compiled once into a matcher
+    new->matchers = malloc(new->nattrs * sizeof(Matcher));
+    assert(new->matchers != NULL);
+    new->lastMatcher = -1;
+    Bool valid = TRUE;
     for (i = 0; i < new->nattrs; i++) {
-        if (strcmp(new->queryValues[i], "?") == 0 || strchr(new->queryValues[i], '%') != NULL) {
-            vals[i] = malloc(2);
-            assert(vals[i] != NULL);
-            strcpy(vals[i], "*");
-        } else {
-            vals[i] = malloc(strlen(new->queryValues[i]) + 1);
-            assert(vals[i] != NULL);
-            strcpy(vals[i], new->queryValues[i]);
-        }
+        if (!compileMatcher(&new->matchers[i], new->queryValues[i], attrType(r, i)))
+            valid = FALSE;
+        if (new->matchers[i].kind != MATCH_ANY) new->lastMatcher = i;
+    }
+    if (!valid) {
+        new->pool = NULL;
+        new->curpage = NULL;
+        new->locs = NULL;
+        new->bitmap = NULL;
+        new->borrowed = NULL;
+        new->sequential = FALSE;
+        new->chunk = NULL;
+        closeSelection(new);
+        return NULL;
     }
 
     // known and unknown are computed using cv
+    // only exact values (in stored form, for numbers) give hash bits
     ChVecItem *cv = chvec(r);
     for (i = 0; i < MAXBITS; i++) {
         int a = cv[i].att;
         int b = cv[i].bit;
-        if (strcmp(vals[a], "*") != 0) {
-            Bits h = hash_any((unsigned char *)vals[a], strlen(vals[a]));
+        Matcher *m = &new->matchers[a];
+        if (m->kind == MATCH_EXACT && !m->text && m->nsegs == 1) {
+            Bits h = hash_any((unsigned char *)m->segs[0], m->seglens[0]);
             if (bitIsSet(h, b)) {
                 new->known = setBit(new->known, i);
             }
@@ -239,100 +993,268 @@ Selection startSelection(Reln r, char *q)
             new->unknown = setBit(new->unknown, i);
         }
     }
-    
-    for (i = 0; i < new->nattrs; i++) {
-        free(vals[i]);
-    }
-    free(vals);
-
-    // candidate pages are generated using known and unknown bit combination generation
-    int depthVal = depth(r);
-    PageID sp = splitp(r);
-    int countD = 0;
-    // d bits are used to generate candidate bucket numbers
-    PageID *candD = genCandidates(new->known, new->unknown, depthVal, &countD);
-
-    int countDplus = 0;
-    // d + 1 bits are used to generate candidate bucket numbers
-    PageID *candDplus = genCandidates(new->known, new->unknown, depthVal + 1, &countDplus);
-
-    // merge the two candidate sets:
-    // For d-bit candidates, only those with values >= sp are kept
-    // For d+1-bit candidates, only those with values < sp are kept
-    int totalCandidates = 0;
-    PageID *tempCandidates = malloc((countD + countDplus) * sizeof(PageID));
-    assert(tempCandidates != NULL);
-    int mask = (1 << depthVal) - 1;
-    // d bit candidates are processed
-    for (i = 0; i < countD; i++) {
-        if (candD[i] >= sp) {
-            tempCandidates[totalCandidates++] = candD[i];
-        }
-    }
-    // d+1 bit candidates are processed
-    for (i = 0; i < countDplus; i++) {
-        if ((candDplus[i] & mask) < sp) {
-            tempCandidates[totalCandidates++] = candDplus[i];
-        }
-    }
-    free(candD);
-    free(candDplus);
-
-    // copy the candidate pages into the Selection object
-    new->candidates = malloc(totalCandidates * sizeof(PageID));
-    assert(new->candidates != NULL);
-    for (i = 0; i < totalCandidates; i++) {
-        new->candidates[i] = tempCandidates[i];
-    }
-    free(tempCandidates);
-    new->ncandidates = totalCandidates;
-    new->currCandidate = 0;
-
-    // if a candidate page exists, the first candidate page is loaded
-    if (new->ncandidates > 0) {
-        new->curPageId = new->candidates[0];
-        new->curScanPageId = new->curPageId;
-        new->curtupOffset = 0;
-        new->curtupIndex = 0;
-        new->curpage = getPage(dataFile(r), new->curPageId);
-    } else {
-        new->curpage = NULL;
+
+    // candidate pages are enumerated lazily from the known and unknown bits
+    // the first one is only read by the first call of getNextTuple()
+    startCandidates(&new->cands, r, new->known, new->unknown);
+    unionCandidates(new);
+    if (plan)
+        chooseIndex(new);
+    else {
+        new->locs = NULL;
+        new->nlocs = new->curloc = 0;
+        new->path = NULL;
+        new->bitmap = NULL;
+        new->counted = FALSE;
     }
+    new->sequential = plan && (new->locs == NULL) && useSequential(new);
+    new->chunk = NULL;
+    new->curpage = NULL;
+    new->pool = NULL;
+    new->out.tuples = NULL;
+    new->out.n = new->nout = 0;
+    new->borrowed = NULL;
 
     return new;
 }
 
+Selection startSelection(Reln r, char *q)
+{
+    return newSelection(r, q, TRUE);
+}
+
 // --------------------------------------------------------------------------
-Tuple getNextTuple(Selection s)
+// can bucket b hold any matching tuple?
+// exact-match values are checked against the bucket's Bloom filters
+//   (if the relation has them); a miss on any one rules out the chain,
+//   as do misses on every value of an IN-list
+
+static Bool bucketMayMatch(Selection s, PageID b)
 {
+    for (int i = 0; i <= s->lastMatcher; i++) {
+        Matcher *m = &s->matchers[i];
+        if (exactAlts(m)) {
+            Bool may = FALSE;
+            for (int k = 0; k < m->nalts && !may; k++)
+                may = bucketMayContain(s->rel, b, i, m->alts[k].segs[0], m->alts[k].seglens[0]);
+            if (!may) return FALSE;
+        }
+        if (m->kind != MATCH_EXACT || m->nsegs != 1) continue;
+        if (!bucketMayContain(s->rel, b, i, m->segs[0], m->seglens[0]))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// --------------------------------------------------------------------------
+// Parallel selection
+// Worker threads take candidate buckets one at a time from the shared
+// candidate iterator, so each bucket chain is scanned by exactly one
+// worker. A worker collects the matching tuples from its bucket into a
+// ResultBatch and queues it in one of QUEUESLOTS slots; getNextTuple()
+// hands out the queued tuples. Workers block while the queue is full,
+// so memory use is bounded however slowly results are consumed.
+// - unordered: slots form a FIFO, results come out as buckets finish
+// - ordered: the bucket handed out as the n'th candidate always uses
+//   slot n%QUEUESLOTS, and workers don't take buckets more than
+//   QUEUESLOTS ahead of the reader; results come out in bucket order,
+//   i.e. exactly as from a serial selection that follows the chains
+
+// scan bucket b and its overflow chain, collecting copies of matching tuples
+static void scanBucket(Selection s, PageID b, PageIndex *ix, ResultBatch *res)
+{
+    Count size = 0;
+    res->tuples = NULL;
+    res->n = 0;
+    FILE *f = dataFile(s->rel);
+    PageID pid = b;
+    while (pid != NO_PAGE) {
+        Page p = getPage(f, pid);
+        indexPage(p, ix);
+        for (Count i = 0; i < ix->ntuples; i++) {
+            if (!matchIndexed(s, p, ix, i)) continue;
+            Count len;
+            char *tuple = indexedTuple(p, ix, i, &len);
+            char *copy = malloc(len + 1);
+            assert(copy != NULL);
+            memcpy(copy, tuple, len);
+            copy[len] = '\0';
+            if (res->n == size) {
+                size = (size == 0) ? 16 : 2*size;
+                res->tuples = realloc(res->tuples, size * sizeof(Tuple));
+                assert(res->tuples != NULL);
+            }
+            res->tuples[res->n++] = copy;
+        }
+        pid = pageOvflow(p);
+        free(p);
+        f = ovflowFile(s->rel);
+    }
+}
+
+static void freeBatch(ResultBatch *res, Count from)
+{
+    for (Count i = from; i < res->n; i++) free(res->tuples[i]);
+    free(res->tuples);
+    res->tuples = NULL;
+    res->n = 0;
+}
+
+// body of each worker thread
+static void *scanWorker(void *arg)
+{
+    Selection s = arg;
+    ScanPool *pl = s->pool;
+    PageIndex *ix = malloc(sizeof(PageIndex));
+    assert(ix != NULL);
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        // ordered: keep within QUEUESLOTS buckets of the reader
+        while (pl->ordered && !pl->stop && pl->nextSeq - pl->head >= QUEUESLOTS)
+            pthread_cond_wait(&pl->space, &pl->lock);
+        PageID b;
+        Bool got = FALSE;
+        while (!pl->stop && nextCandidate(&s->cands, &b)) {
+            if (bucketMayMatch(s, b)) { got = TRUE; break; }
+        }
+        if (!got) break;
+        Count seq = pl->nextSeq++;
+        pthread_mutex_unlock(&pl->lock);
+
+        ResultBatch res;
+        scanBucket(s, b, ix, &res);
+
+        pthread_mutex_lock(&pl->lock);
+        while (!pl->ordered && !pl->stop && pl->nqueued == QUEUESLOTS)
+            pthread_cond_wait(&pl->space, &pl->lock);
+        if (pl->stop) {
+            freeBatch(&res, 0);
+            break;
+        }
+        if (!pl->ordered) seq = pl->head + pl->nqueued++;
+        res.ready = TRUE;
+        pl->slots[seq % QUEUESLOTS] = res;
+        pthread_cond_broadcast(&pl->results);
+    }
+    pl->running--;
+    pthread_cond_broadcast(&pl->results);
+    pthread_mutex_unlock(&pl->lock);
+    free(ix);
+    return NULL;
+}
+
+// next tuple from a parallel selection, or NULL when all are returned
+static Tuple nextPooledTuple(Selection s)
+{
+    ScanPool *pl = s->pool;
+    while (s->nout == s->out.n) {
+        freeBatch(&s->out, s->nout);
+        s->nout = 0;
+        pthread_mutex_lock(&pl->lock);
+        ResultBatch *slot = &pl->slots[pl->head % QUEUESLOTS];
+        while (!slot->ready && pl->running > 0)
+            pthread_cond_wait(&pl->results, &pl->lock);
+        if (!slot->ready) {
+            // every worker has finished and everything has been returned
+            pthread_mutex_unlock(&pl->lock);
+            return NULL;
+        }
+        s->out = *slot;
+        slot->ready = FALSE;
+        slot->tuples = NULL;
+        pl->head++;
+        if (!pl->ordered) pl->nqueued--;
+        pthread_cond_broadcast(&pl->space);
+        pthread_mutex_unlock(&pl->lock);
+    }
+    return s->out.tuples[s->nout++];
+}
+
+// start a selection whose candidate buckets are scanned by nworkers
+//   threads; with ordered, tuples are returned in bucket order, as
+//   by a serial selection that follows the chains
+// nworkers <= 1 gives an ordinary (serial) selection
+Selection startParallelSelection(Reln r, char *q, Count nworkers, Bool ordered)
+{
+    Selection s = startSelection(r, q);
+    // index lookups read few pages; they aren't worth the threads
+    if (s == NULL || nworkers <= 1 || s->locs != NULL) return s;
+    if (nworkers > MAXWORKERS) nworkers = MAXWORKERS;
+    ScanPool *pl = malloc(sizeof(ScanPool));
+    assert(pl != NULL);
+    memset(pl, 0, sizeof(ScanPool));
+    pl->nworkers = nworkers;
+    pl->ordered = ordered;
+    pl->running = nworkers;
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->space, NULL);
+    pthread_cond_init(&pl->results, NULL);
+    s->pool = pl;
+    s->sequential = FALSE;
+    for (Count i = 0; i < nworkers; i++)
+        pthread_create(&pl->workers[i], NULL, scanWorker, s);
+    return s;
+}
+
+// stop the workers of a parallel selection and discard unread results
+static void closePool(Selection s)
+{
+    ScanPool *pl = s->pool;
+    pthread_mutex_lock(&pl->lock);
+    pl->stop = TRUE;
+    pthread_cond_broadcast(&pl->space);
+    pthread_mutex_unlock(&pl->lock);
+    for (Count i = 0; i < pl->nworkers; i++)
+        pthread_join(pl->workers[i], NULL);
+    for (Count i = 0; i < QUEUESLOTS; i++) {
+        if (pl->slots[i].ready) freeBatch(&pl->slots[i], 0);
+    }
+    freeBatch(&s->out, s->nout);
+    pthread_mutex_destroy(&pl->lock);
+    pthread_cond_destroy(&pl->space);
+    pthread_cond_destroy(&pl->results);
+    free(pl);
+}
+
+// --------------------------------------------------------------------------
+// next matching tuple, borrowed from the scan: the result points into
+//   the current page (or, for a parallel selection, a result batch)
+//   and is only valid until the next call on s
+// *len is set to its length; it is also '\0'-terminated
+// returns NULL when there are no more matching tuples
+// callers that need to keep a tuple must copy it (see getNextTuple())
+char *getNextTupleSpan(Selection s, Count *len)
+{
+    if (s->pool != NULL) {
+        // tuples from workers are already copies; hold on to one at a time
+        free(s->borrowed);
+        s->borrowed = nextPooledTuple(s);
+        if (s->borrowed != NULL) *len = strlen(s->borrowed);
+        return s->borrowed;
+    }
+
+    if (s->locs != NULL) return nextIndexedTuple(s, len);
+    if (s->sequential) return nextSequentialTuple(s, len);
+
     // iterate over the set of candidate pages
-    while (s->currCandidate < s->ncandidates) {
+    for (;;) {
         if (s->curpage == NULL) {
-            s->curPageId = s->candidates[s->currCandidate];
-            s->curScanPageId = s->curPageId;
+            if (!nextCandidate(&s->cands, &s->curPageId)) break;
+            if (!bucketMayMatch(s, s->curPageId)) continue;
             s->is_ovflow = 0;
-            s->curtupIndex = 0;
-            s->curtupOffset = 0;
-            s->curpage = getPage(dataFile(s->rel), s->curPageId);
+            loadPage(s, dataFile(s->rel), s->curPageId);
         }
 
         // scan the current candidate page and its overflow chain
         while (s->curpage != NULL) {
             // if there are still unscanned tuples on the current page
-            if (s->curtupIndex < pageNTuples(s->curpage)) {
-                // use curtupOffset to access the current tuple directly
-                char *pageDataPtr = pageData(s->curpage);
-                char *tuple = pageDataPtr + s->curtupOffset;
-                s->curtupOffset += strlen(tuple) + 1;
-                s->curtupIndex++;
+            if (s->curtupIndex < s->index.ntuples) {
+                // use the page index to access the current tuple directly
+                Count i = s->curtupIndex++;
 
                 // if a tuple satisfies the query condition, the tuple is returned
-                if (matchTuple(s, tuple)) {
-                    char *copy = malloc(strlen(tuple) + 1);
-                    assert(copy != NULL);
-                    strcpy(copy, tuple);
-                    return copy;
-                }
+                if (matchIndexed(s, s->curpage, &s->index, i))
+                    return indexedTuple(s->curpage, &s->index, i, len);
             } else {
                 // all tuples of the current page have been scanned to check for overflow pages
                 PageID nextPageId = pageOvflow(s->curpage);
@@ -340,10 +1262,7 @@ Tuple getNextTuple(Selection s)
                 if (nextPageId != NO_PAGE) {
                     // overflow page is entered, at which point the state is updated
                     s->is_ovflow = 1;
-                    s->curScanPageId = nextPageId;
-                    s->curtupIndex = 0;
-                    s->curtupOffset = 0;
-                    s->curpage = getPage(ovflowFile(s->rel), nextPageId);
+                    loadPage(s, ovflowFile(s->rel), nextPageId);
                 } else {
                     // current candidate page is scanned and the inner loop is exited to load the next candidate page
                     s->curpage = NULL;
@@ -351,21 +1270,42 @@ Tuple getNextTuple(Selection s)
                 }
             }
         }
-        // current candidate is processed and moves to the next candidate
-        s->currCandidate++;
+        // current candidate is processed; move on to the next candidate
     }
     return NULL;
 }
 
+// next matching tuple, as a copy owned by the caller
+// returns NULL when there are no more matching tuples
+Tuple getNextTuple(Selection s)
+{
+    if (s->pool != NULL) return nextPooledTuple(s);
+    Count len;
+    char *tuple = getNextTupleSpan(s, &len);
+    if (tuple == NULL) return NULL;
+    char *copy = malloc(len + 1);
+    assert(copy != NULL);
+    memcpy(copy, tuple, len);
+    copy[len] = '\0';
+    return copy;
+}
+
 // --------------------------------------------------------------------------
 // closeSelection: release SelectionRep and related resources
 void closeSelection(Selection s)
 {
     if (s == NULL) return;
 
-    if (s->curpage != NULL) {
+    if (s->pool != NULL) closePool(s);
+    free(s->borrowed);
+    free(s->locs);
+    free(s->cands.list);
+    bmapFree(s->bitmap);
+
+    if (s->curpage != NULL && !s->sequential) {
         free(s->curpage);
     }
+    free(s->chunk);
 
     if (s->queryValues != NULL) {
         for (int i = 0; i < s->nattrs; i++) {
@@ -376,9 +1316,139 @@ void closeSelection(Selection s)
         free(s->queryValues);
     }
 
-    if (s->candidates != NULL) {
-        free(s->candidates);
+    if (s->matchers != NULL) {
+        for (int i = 0; i < s->nattrs; i++) freeMatcher(&s->matchers[i]);
+        free(s->matchers);
     }
 
     free(s);
-}
\ No newline at end of file
+}
+// --------------------------------------------------------------------------
+// Multi-query selection
+// Runs a batch of selections on one relation with shared bucket scans.
+// Each query enumerates its own candidate buckets in ascending order,
+// so merging the queries' candidate streams visits every bucket needed
+// by any query exactly once, in ascending order. For each bucket, only
+// the queries that have it as a candidate are evaluated on its tuples.
+struct MultiSelectionRep {
+    Reln    rel;           // Relation being scanned
+    Count   nq;            // Number of queries
+    Selection *sels;       // Per query: matchers and candidate buckets
+    PageID *next;          // Per query: next candidate bucket
+    Bool   *more;          // Per query: next[] is valid
+    Bool   *want;          // Per query: needs the current bucket
+    Page    curpage;       // Current page in scan (NULL between buckets)
+    PageIndex index;       // Tuple/field boundaries in the current page
+    Count   curtupIndex;   // Index of next tuple in the current page
+};
+
+// advance query i to its next candidate that may hold a match
+static void advanceQuery(MultiSelection m, Count i)
+{
+    Selection s = m->sels[i];
+    m->more[i] = FALSE;
+    while (nextCandidate(&s->cands, &m->next[i])) {
+        if (bucketMayMatch(s, m->next[i])) {
+            m->more[i] = TRUE;
+            break;
+        }
+    }
+}
+
+// start n selections on r, one for each query string in qs
+// returns NULL, with *bad set to its index, if a query string is invalid
+MultiSelection startMultiSelection(Reln r, char **qs, Count n, Count *bad)
+{
+    MultiSelection new = malloc(sizeof(struct MultiSelectionRep));
+    assert(new != NULL);
+    new->rel = r;
+    new->nq = n;
+    new->sels = malloc((n+1) * sizeof(Selection));
+    new->next = malloc((n+1) * sizeof(PageID));
+    new->more = malloc((n+1) * sizeof(Bool));
+    new->want = malloc((n+1) * sizeof(Bool));
+    assert(new->sels != NULL && new->next != NULL && new->more != NULL && new->want != NULL);
+    new->curpage = NULL;
+    new->curtupIndex = 0;
+    for (Count i = 0; i < n; i++) {
+        // tuples are matched bucket by bucket; no index or sequential scan
+        new->sels[i] = newSelection(r, qs[i], FALSE);
+        if (new->sels[i] == NULL) {
+            *bad = i;
+            new->nq = i;
+            closeMultiSelection(new);
+            return NULL;
+        }
+        advanceQuery(new, i);
+        new->want[i] = FALSE;
+    }
+    return new;
+}
+
+// next tuple matching at least one query, or NULL when there are no more
+// matches[i] is set to whether the tuple matches query i
+Tuple getNextMultiTuple(MultiSelection m, Bool *matches)
+{
+    for (;;) {
+        if (m->curpage == NULL) {
+            // smallest bucket that any query still needs
+            Bool found = FALSE;
+            PageID b = 0;
+            for (Count i = 0; i < m->nq; i++) {
+                if (m->more[i] && (!found || m->next[i] < b)) {
+                    b = m->next[i];
+                    found = TRUE;
+                }
+            }
+            if (!found) return NULL;
+            for (Count i = 0; i < m->nq; i++) {
+                m->want[i] = m->more[i] && m->next[i] == b;
+                if (m->want[i]) advanceQuery(m, i);
+            }
+            m->curpage = getPage(dataFile(m->rel), b);
+            indexPage(m->curpage, &m->index);
+            m->curtupIndex = 0;
+        }
+
+        while (m->curtupIndex < m->index.ntuples) {
+            Count t = m->curtupIndex++;
+            Bool any = FALSE;
+            for (Count i = 0; i < m->nq; i++) {
+                matches[i] = m->want[i]
+                          && matchIndexed(m->sels[i], m->curpage, &m->index, t);
+                if (matches[i]) any = TRUE;
+            }
+            if (any) {
+                Count len;
+                char *tuple = indexedTuple(m->curpage, &m->index, t, &len);
+                char *copy = malloc(len + 1);
+                assert(copy != NULL);
+                memcpy(copy, tuple, len);
+                copy[len] = '\0';
+                return copy;
+            }
+        }
+
+        // move on through the overflow chain, then to the next bucket
+        PageID nextPageId = pageOvflow(m->curpage);
+        free(m->curpage);
+        m->curpage = NULL;
+        if (nextPageId != NO_PAGE) {
+            m->curpage = getPage(ovflowFile(m->rel), nextPageId);
+            indexPage(m->curpage, &m->index);
+            m->curtupIndex = 0;
+        }
+    }
+}
+
+void closeMultiSelection(MultiSelection m)
+{
+    if (m == NULL) return;
+    if (m->curpage != NULL) free(m->curpage);
+    for (Count i = 0; i < m->nq; i++) closeSelection(m->sels[i]);
+    free(m->sels);
+    free(m->next);
+    free(m->more);
+    free(m->want);
+    free(m);
+}
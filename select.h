@@ -8,12 +8,20 @@
 #define SELECTION_H 1
 
 typedef struct SelectionRep *Selection;
+typedef struct MultiSelectionRep *MultiSelection;
 
 #include "reln.h"
 #include "tuple.h"
 
 Selection startSelection(Reln, char *);
+Selection startParallelSelection(Reln, char *, Count, Bool);
 Tuple getNextTuple(Selection);
+char *getNextTupleSpan(Selection, Count *);
+Bool selectionCount(Selection, Count *);
+void explainSelection(Selection, FILE *);
 void closeSelection(Selection);
+MultiSelection startMultiSelection(Reln, char **, Count, Count *);
+Tuple getNextMultiTuple(MultiSelection, Bool *);
+void closeMultiSelection(MultiSelection);
 
 #endif
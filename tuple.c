@@ -3,6 +3,9 @@
 // Credt: John Shepherd
 // Last modified by Ziyi Shi, Apr 2024
 
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
 #include "defs.h"
 #include "tuple.h"
 #include "reln.h"
@@ -11,6 +14,105 @@
 #include "bits.h"
 #include "util.h"
 
+// Typed attributes
+// Values of int and float attributes are kept in pages in binary,
+// not as text. The binary form must leave the page layout working
+// (no '\0' or ',' bytes), and it preserves order, so that stored
+// values compare with memcmp as the numbers do: each number is mapped
+// to an unsigned key (ints: sign bit flipped; doubles: sign bit set
+// if positive, all bits flipped if negative), which is written 7 bits
+// per byte, most significant first, with the top bit of every byte
+// set. An int takes INTBYTES, a float FLOATBYTES.
+// Tuples come in as text and go out as text; only pages (and the
+// indexes built from them) hold the binary form.
+
+#define INTBYTES   5   // 32 bits, 7 per byte
+#define FLOATBYTES 10  // 64 bits, 7 per byte
+
+static void putKey(unsigned long long k, int n, char *buf)
+{
+	for (int i = n-1; i >= 0; i--) {
+		buf[i] = (char)(0x80 | (k & 0x7f));
+		k >>= 7;
+	}
+}
+
+static unsigned long long getKey(char *val, int n)
+{
+	unsigned long long k = 0;
+	for (int i = 0; i < n; i++) k = (k << 7) | (val[i] & 0x7f);
+	return k;
+}
+
+// stored form in buf of attribute value val (len bytes of text)
+// returns its length, or -1 if val isn't a valid value of type
+
+int encodeValue(Count type, char *val, Count len, char *buf)
+{
+	if (type == TYPE_STRING) {
+		memcpy(buf, val, len);
+		return len;
+	}
+	char text[MAXTUPLEN+1], *end;
+	if (len == 0 || len > MAXTUPLEN) return -1;
+	memcpy(text, val, len);
+	text[len] = '\0';
+	errno = 0;
+	if (type == TYPE_INT) {
+		long x = strtol(text, &end, 10);
+		if (*end != '\0' || errno != 0 || x < INT_MIN || x > INT_MAX) return -1;
+		putKey((unsigned)x ^ 0x80000000u, INTBYTES, buf);
+		return INTBYTES;
+	}
+	double x = strtod(text, &end);
+	if (*end != '\0' || isnan(x)) return -1;
+	if (x == 0) x = 0;  // no -0
+	unsigned long long k;
+	memcpy(&k, &x, sizeof(k));
+	k = (k >> 63) ? ~k : k | (1ULL << 63);
+	putKey(k, FLOATBYTES, buf);
+	return FLOATBYTES;
+}
+
+// text form in buf of stored attribute value val (len bytes)
+// returns its length
+
+Count valueText(Count type, char *val, Count len, char *buf)
+{
+	if (type == TYPE_INT && len == INTBYTES)
+		return sprintf(buf, "%d", (int)(getKey(val, INTBYTES) ^ 0x80000000u));
+	if (type == TYPE_FLOAT && len == FLOATBYTES) {
+		unsigned long long k = getKey(val, FLOATBYTES);
+		k = (k >> 63) ? k & ~(1ULL << 63) : ~k;
+		double x;
+		memcpy(&x, &k, sizeof(x));
+		// shortest form that reads back as the same number
+		int n = sprintf(buf, "%.15g", x);
+		if (strtod(buf, NULL) != x) n = sprintf(buf, "%.17g", x);
+		return n;
+	}
+	memcpy(buf, val, len);
+	return len;
+}
+
+// text form in buf (MAXTEXTLEN bytes) of stored tuple t (len bytes)
+// returns its length
+
+Count tupleText(Reln r, char *t, Count len, char *buf)
+{
+	char *c = t, *end = t + len, *b = buf;
+	for (Count a = 0; ; a++) {
+		char *comma = memchr(c, ',', end - c);
+		Count n = ((comma == NULL) ? end : comma) - c;
+		b += valueText(attrType(r, a), c, n, b);
+		if (comma == NULL) break;
+		*b++ = ',';
+		c = comma + 1;
+	}
+	*b = '\0';
+	return b - buf;
+}
+
 // return number of bytes/chars in a tuple
 
 int tupLength(Tuple t)
@@ -18,22 +120,51 @@ int tupLength(Tuple t)
 	return strlen(t);
 }
 
-// reads/parses next tuple in input
+// reads/parses next tuple (one line) in input
+// sets *t to the tuple, or to NULL at the end of the input
+// returns ~OK if the line isn't a valid tuple for r (wrong number of
+//   fields, a value that isn't a number of its attribute's type, or
+//   too long); *t is then NULL, and the line is left in err (MAXTUPLEN)
 
-Tuple readTuple(Reln r, FILE *in)
+Status readTuple(Reln r, FILE *in, Tuple *t, char *err)
 {
 	char line[MAXTUPLEN];
+	*t = NULL;
 	if (fgets(line, MAXTUPLEN-1, in) == NULL)
-		return NULL;
-	line[strlen(line)-1] = '\0';
+		return OK;
+	Count len = strlen(line);
+	Bool whole = (len > 0 && line[len-1] == '\n') || feof(in);
+	if (len > 0 && line[len-1] == '\n') line[--len] = '\0';
+	strcpy(err, line);
+	if (!whole) return ~OK;
 	// count fields
 	// cheap'n'nasty parsing
 	char *c; int nf = 1;
 	for (c = line; *c != '\0'; c++)
 		if (*c == ',') nf++;
 	// invalid tuple
-	if (nf != nattrs(r)) return NULL;
-	return copyString(line); // needs to be free'd sometime
+	if (nf != nattrs(r)) return ~OK;
+	if (types(r) == 0) {
+		*t = copyString(line); // needs to be free'd sometime
+		return OK;
+	}
+	// numbers are stored in binary
+	char tup[MAXTUPLEN+10*FLOATBYTES], *b = tup;
+	c = line;
+	for (Count a = 0; ; a++) {
+		char *end = strchr(c, ',');
+		Count len = (end == NULL) ? strlen(c) : end - c;
+		int n = encodeValue(attrType(r, a), c, len, b);
+		if (n < 0) return ~OK;
+		b += n;
+		if (end == NULL) break;
+		*b++ = ',';
+		c = end + 1;
+	}
+	*b = '\0';
+	if (b - tup >= MAXTUPLEN) return ~OK;
+	*t = copyString(tup);
+	return OK;
 }
 
 // extract values into an array of strings
@@ -138,10 +269,11 @@ Bool tupleMatch(Reln r, Tuple pt, Tuple t)
 }
 
 // puts printable version of tuple in user-supplied buffer
+//   (of MAXTEXTLEN bytes)
 
-void tupleString(Tuple t, char *buf)
+void tupleString(Reln r, Tuple t, char *buf)
 {
-	strcpy(buf,t);
+	tupleText(r, t, strlen(t), buf);
 }
 
 // release memory used for tuple
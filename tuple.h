@@ -11,16 +11,22 @@
 
 typedef char *Tuple;
 
+// longest text form of a stored tuple (numbers grow when shown)
+#define MAXTEXTLEN (3*MAXTUPLEN)
+
 #include "reln.h"
 #include "bits.h"
 
 int tupLength(Tuple t);
-Tuple readTuple(Reln r, FILE *in);
+Status readTuple(Reln r, FILE *in, Tuple *t, char *err);
 Bits tupleHash(Reln r, Tuple t);
 void tupleVals(Tuple t, char **vals);
 void freeVals(char **vals, int nattrs);
 Bool tupleMatch(Reln r, Tuple pt, Tuple t);
-void tupleString(Tuple t, char *buf);
+void tupleString(Reln r, Tuple t, char *buf);
+int encodeValue(Count type, char *val, Count len, char *buf);
+Count valueText(Count type, char *val, Count len, char *buf);
+Count tupleText(Reln r, char *t, Count len, char *buf);
 void freeTuple(Tuple t); //** release memory used for tuple
 
 #endif
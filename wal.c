@@ -0,0 +1,317 @@
+// wal.c ... write-ahead log for relation updates
+// part of Multi-attribute Linear-hashed Files
+// Redo log of page after-images with group commit
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "defs.h"
+#include "wal.h"
+#include "page.h"
+#include "hash.h"
+
+// A Wal holds every page modified since the last group commit.
+// Modified pages are *not* written to the data/ovflow files straight
+// away; they stay in the Wal's dirty-page table (and reads of them
+// are served from there) until walFlush() commits the group:
+// - an after-image of each dirty page, an image of the .info header
+//   and a commit record are appended to RelName.wal with one write()
+// - the log is fsync'd (the only fsync for the whole group)
+// - the dirty pages are then written back to their files, unsynced
+// A crash before the fsync loses the group, but none of its pages
+// have reached the files. A crash after it is repaired by replaying
+// the log (walRecover). The log is emptied at a checkpoint, once the
+// files themselves have been fsync'd.
+
+#define WALHASH     1024           // dirty-page hash table size
+#define WALMAXBYTES (4*1024*1024)  // checkpoint when log gets this big
+
+// log record types
+#define WAL_PAGEREC 1  // after-image of a page in data/ovflow
+#define WAL_INFOREC 2  // image of the start of the info file
+#define WAL_COMMIT  3  // end of a group of records
+
+typedef struct {
+	Count  type;   // WAL_PAGEREC, WAL_INFOREC, WAL_COMMIT
+	Count  file;   // WAL_DATA, WAL_OVFLOW or WAL_INFO
+	PageID pid;    // page within file (WAL_PAGEREC)
+	Count  len;    // #bytes of payload following the record
+	Bits   check;  // checksum of record and payload
+} WalRecord;
+
+typedef struct DirtyPage {
+	int    file;   // WAL_DATA or WAL_OVFLOW
+	PageID pid;    // page within file
+	Page   page;   // latest contents
+	struct DirtyPage *next;  // next in hash chain
+	struct DirtyPage *link;  // next in list of all dirty pages
+} DirtyPage;
+
+struct WalRep {
+	char   name[MAXFILENAME]; // name of log file
+	int    fd;                // log file, opened for append
+	FILE  *files[3];          // data, ovflow, info
+	Count  nbytes;            // bytes logged since last checkpoint
+	Count  seqno;             // sequence number of next group
+	DirtyPage *table[WALHASH];// dirty pages, by (file,pid)
+	DirtyPage *dirty;         // all dirty pages
+	pthread_mutex_t lock;     // guards the dirty-page table
+};
+
+// checksum over a record (with check field zeroed) and its payload
+
+static Bits walCheck(WalRecord *rec, Byte *payload)
+{
+	Bits saved = rec->check;
+	rec->check = 0;
+	Bits h = hash_any((unsigned char *)rec, sizeof(WalRecord));
+	rec->check = saved;
+	if (rec->len > 0) h ^= hash_any(payload, rec->len) * 31;
+	return h;
+}
+
+static int walHash(int file, PageID pid)
+{
+	return (pid*2 + file) % WALHASH;
+}
+
+// write all of buf to fd (write() may write less than asked)
+
+static Status writeAll(int fd, Byte *buf, Count len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n <= 0) return ~OK;
+		buf += n; len -= n;
+	}
+	return OK;
+}
+
+// open (creating if needed) the log for relation name
+
+Wal walOpen(char *name, FILE *data, FILE *ovflow, FILE *info)
+{
+	Wal w = malloc(sizeof(struct WalRep));
+	assert(w != NULL);
+	sprintf(w->name,"%s.wal",name);
+	w->fd = open(w->name, O_WRONLY|O_CREAT|O_APPEND, 0644);
+	assert(w->fd >= 0);
+	struct stat st;
+	fstat(w->fd, &st);
+	w->nbytes = st.st_size;
+	w->files[WAL_DATA] = data;
+	w->files[WAL_OVFLOW] = ovflow;
+	w->files[WAL_INFO] = info;
+	w->seqno = 0;
+	memset(w->table, 0, sizeof(w->table));
+	w->dirty = NULL;
+	pthread_mutex_init(&w->lock, NULL);
+	return w;
+}
+
+// release the log; caller checkpoints first, so log is empty
+
+void walClose(Wal w)
+{
+	assert(w->dirty == NULL);
+	close(w->fd);
+	if (w->nbytes == 0) unlink(w->name);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+// fetch a copy of a dirty page, or NULL if the page is not dirty
+
+Page walGetPage(Wal w, int file, PageID pid)
+{
+	Page p = NULL;
+	pthread_mutex_lock(&w->lock);
+	DirtyPage *d;
+	for (d = w->table[walHash(file,pid)]; d != NULL; d = d->next) {
+		if (d->file == file && d->pid == pid) {
+			p = malloc(PAGESIZE);
+			assert(p != NULL);
+			memcpy(p, d->page, PAGESIZE);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	return p;
+}
+
+// record new contents for a page; the Wal takes over the buffer
+
+void walPutPage(Wal w, int file, PageID pid, Page p)
+{
+	pthread_mutex_lock(&w->lock);
+	int h = walHash(file,pid);
+	DirtyPage *d;
+	for (d = w->table[h]; d != NULL; d = d->next) {
+		if (d->file == file && d->pid == pid) break;
+	}
+	if (d != NULL)
+		free(d->page);
+	else {
+		d = malloc(sizeof(DirtyPage));
+		assert(d != NULL);
+		d->file = file; d->pid = pid;
+		d->next = w->table[h]; w->table[h] = d;
+		d->link = w->dirty; w->dirty = d;
+	}
+	d->page = p;
+	pthread_mutex_unlock(&w->lock);
+}
+
+// append one record to a buffer of log records
+
+static Byte *addRecord(Byte *buf, Count type, Count file, PageID pid, Byte *payload, Count len)
+{
+	WalRecord rec = { type, file, pid, len, 0 };
+	rec.check = walCheck(&rec, payload);
+	memcpy(buf, &rec, sizeof(WalRecord));
+	if (len > 0) memcpy(buf+sizeof(WalRecord), payload, len);
+	return buf + sizeof(WalRecord) + len;
+}
+
+// commit the current group: log all dirty pages plus the info
+//   header, fsync the log once, then write the pages back
+// caller must make sure no updates are in progress
+
+Status walFlush(Wal w, Byte *info, Count len)
+{
+	pthread_mutex_lock(&w->lock);
+	if (w->dirty == NULL) {
+		pthread_mutex_unlock(&w->lock);
+		return OK;
+	}
+	Count ndirty = 0;
+	DirtyPage *d;
+	for (d = w->dirty; d != NULL; d = d->link) ndirty++;
+	Count size = ndirty*(sizeof(WalRecord)+PAGESIZE)
+	           + sizeof(WalRecord)+len + sizeof(WalRecord)+sizeof(Count);
+	Byte *buf = malloc(size);
+	assert(buf != NULL);
+	Byte *b = buf;
+	for (d = w->dirty; d != NULL; d = d->link)
+		b = addRecord(b, WAL_PAGEREC, d->file, d->pid, (Byte *)d->page, PAGESIZE);
+	b = addRecord(b, WAL_INFOREC, WAL_INFO, 0, info, len);
+	b = addRecord(b, WAL_COMMIT, 0, 0, (Byte *)&w->seqno, sizeof(Count));
+	assert(b == buf+size);
+
+	Status ok = writeAll(w->fd, buf, size);
+	if (ok == OK && fdatasync(w->fd) != 0) ok = ~OK;
+	free(buf);
+	if (ok != OK) {
+		pthread_mutex_unlock(&w->lock);
+		return ok;
+	}
+	w->nbytes += size;
+	w->seqno++;
+
+	// group is durable; now the pages can go to their files
+	while (w->dirty != NULL) {
+		d = w->dirty;
+		w->dirty = d->link;
+		putPage(w->files[d->file], d->pid, d->page);
+		free(d);
+	}
+	memset(w->table, 0, sizeof(w->table));
+	ssize_t n = pwrite(fileno(w->files[WAL_INFO]), info, len, 0);
+	assert(n == len);
+	pthread_mutex_unlock(&w->lock);
+	return OK;
+}
+
+// has the log grown enough that it should be checkpointed?
+
+Bool walFull(Wal w)
+{
+	return (w->nbytes >= WALMAXBYTES);
+}
+
+// flush, then force the files themselves to disk; after that
+//   the log is no longer needed and is emptied
+
+Status walCheckpoint(Wal w, Byte *info, Count len)
+{
+	if (walFlush(w, info, len) != OK) return ~OK;
+	if (w->nbytes == 0) return OK;
+	for (int i = 0; i < 3; i++) {
+		if (fsync(fileno(w->files[i])) != 0) return ~OK;
+	}
+	if (ftruncate(w->fd, 0) != 0) return ~OK;
+	w->nbytes = 0;
+	return OK;
+}
+
+// replay committed groups from the log of relation name, if any
+// records after the last intact commit record are ignored
+// the caller must hold the relation's exclusive lock (see openRelation),
+//   so no live writer is still appending to the log
+// returns TRUE if anything was replayed
+
+Bool walRecover(char *name)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname,"%s.wal",name);
+	int fd = open(fname, O_RDONLY);
+	if (fd < 0) return FALSE;
+	struct stat st;
+	fstat(fd, &st);
+	Count size = st.st_size;
+	Byte *log = malloc(size+1);
+	assert(log != NULL);
+	Count got = 0;
+	while (got < size) {
+		ssize_t n = read(fd, log+got, size-got);
+		if (n <= 0) break;
+		got += n;
+	}
+	close(fd);
+
+	// find end of last complete group
+	Count pos = 0, committed = 0;
+	while (pos + sizeof(WalRecord) <= got) {
+		WalRecord rec;
+		memcpy(&rec, log+pos, sizeof(WalRecord));
+		if (rec.len > got - pos - sizeof(WalRecord)) break;
+		if (walCheck(&rec, log+pos+sizeof(WalRecord)) != rec.check) break;
+		pos += sizeof(WalRecord) + rec.len;
+		if (rec.type == WAL_COMMIT) committed = pos;
+	}
+
+	Bool replayed = FALSE;
+	FILE *files[3];
+	char *suffix[3] = { "data", "ovflow", "info" };
+	Bool opened = TRUE;
+	for (int i = 0; i < 3; i++) {
+		sprintf(fname,"%s.%s",name,suffix[i]);
+		files[i] = (committed > 0) ? fopen(fname,"r+") : NULL;
+		if (files[i] == NULL) opened = FALSE;
+	}
+	if (committed > 0 && opened) {
+		pos = 0;
+		while (pos < committed) {
+			WalRecord rec;
+			memcpy(&rec, log+pos, sizeof(WalRecord));
+			Byte *payload = log+pos+sizeof(WalRecord);
+			off_t at = (rec.type == WAL_PAGEREC) ? (off_t)rec.pid*PAGESIZE : 0;
+			if (rec.type != WAL_COMMIT) {
+				ssize_t n = pwrite(fileno(files[rec.file]), payload, rec.len, at);
+				assert(n == rec.len);
+			}
+			pos += sizeof(WalRecord) + rec.len;
+		}
+		for (int i = 0; i < 3; i++) fsync(fileno(files[i]));
+		replayed = TRUE;
+	}
+	for (int i = 0; i < 3; i++) {
+		if (files[i] != NULL) fclose(files[i]);
+	}
+	free(log);
+	// log is now either replayed or holds nothing committed
+	sprintf(fname,"%s.wal",name);
+	if (committed == 0 || replayed) unlink(fname);
+	return replayed;
+}
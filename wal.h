@@ -0,0 +1,27 @@
+// wal.h ... interface to the write-ahead log
+// part of Multi-attribute Linear-hashed Files
+// See wal.c for details of Wal type and functions
+
+#ifndef WAL_H
+#define WAL_H 1
+
+typedef struct WalRep *Wal;
+
+#include "defs.h"
+#include "page.h"
+
+// files covered by the log
+#define WAL_DATA   0
+#define WAL_OVFLOW 1
+#define WAL_INFO   2
+
+Wal walOpen(char *name, FILE *data, FILE *ovflow, FILE *info);
+void walClose(Wal w);
+Bool walRecover(char *name);
+Page walGetPage(Wal w, int file, PageID pid);
+void walPutPage(Wal w, int file, PageID pid, Page p);
+Status walFlush(Wal w, Byte *info, Count len);
+Bool walFull(Wal w);
+Status walCheckpoint(Wal w, Byte *info, Count len);
+
+#endif